@@ -1,21 +1,963 @@
+#include <chrono>
+#include <deque>
 #include <map>
+#include <optional>
+#include "UnionWords.h"
 #include "llvm/Pass.h"
+#include "llvm/IR/DataLayout.h"
 #include "llvm/IR/Module.h"
+#include "llvm/IR/Operator.h"
+#include "llvm/IR/ValueMap.h"
+#include "llvm/IR/ValueSymbolTable.h"
 #include "llvm/Passes/PassBuilder.h"
 #include "llvm/Passes/PassPlugin.h"
+#include "llvm/IR/Intrinsics.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/GraphWriter.h"
+#include "llvm/Support/JSON.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/ThreadPool.h"
+#include "llvm/Support/Threading.h"
+#include "llvm/Support/xxhash.h"
 #include "llvm/Support/raw_ostream.h"
+#include "llvm/Analysis/AliasAnalysis.h"
+#include "llvm/Analysis/CallGraph.h"
 #include "llvm/Analysis/CFG.h"
+#include "llvm/Analysis/MemorySSA.h"
+#include "llvm/Analysis/ValueTracking.h"
+#include "llvm/ADT/BitVector.h"
+#include "llvm/ADT/DenseSet.h"
+#include "llvm/ADT/PostOrderIterator.h"
+#include "llvm/ADT/SCCIterator.h"
+#include "llvm/ADT/SetVector.h"
+#include "llvm/ADT/SparseBitVector.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/ADT/StringMap.h"
 
 using namespace llvm;
 
-using ValueSet = SmallPtrSet<const Value *, 8>;
+// Every value the solver touches is numbered densely; memory objects come
+// first so a points-to set is a sparse bitvector over [0, numObjects).
+using NodeID = unsigned;
+using PtsSet = SparseBitVector<>;
+using PtsID = unsigned;
+
+enum class SolverKind { Andersen, Steensgaard };
+
+static cl::opt<SolverKind> Solver("pta-solver",
+	cl::desc("Points-to solver"),
+	cl::values(
+		clEnumValN(SolverKind::Andersen, "andersen", "Inclusion-based (default)"),
+		clEnumValN(SolverKind::Steensgaard, "steensgaard", "Unification-based: near-linear, coarser")),
+	cl::init(SolverKind::Andersen));
+
+static cl::opt<unsigned> SteensgaardThreshold("pta-steensgaard-threshold",
+	cl::desc("Use the unification solver for constraint systems larger than this (0 disables)"),
+	cl::init(500000));
+
+static cl::opt<unsigned> MemoryBudget("pta-memory-budget",
+	cl::desc("Fall back to the unification solver once points-to sets take more than this many MiB (0 disables)"),
+	cl::init(0));
+
+static cl::opt<uint64_t> VisitBudget("pta-visit-budget",
+	cl::desc("Fall back to the unification solver after this many node visits (0 disables)"),
+	cl::init(0));
+
+static cl::opt<bool> ParallelSolve("pta-parallel",
+	cl::desc("Solve with parallel wave propagation instead of the worklist"),
+	cl::init(false));
+
+static cl::opt<bool> DemandDriven("pta-demand",
+	cl::desc("Solve only the part of the constraint graph each query depends on"),
+	cl::init(false));
+
+static cl::opt<bool> PartialSSA("pta-partial-ssa",
+	cl::desc("Resolve pointer registers defined only by copies outside the solver's fixpoint"),
+	cl::init(false));
+
+static cl::opt<unsigned> SolverThreads("pta-threads",
+	cl::desc("Worker threads for -pta-parallel (0 uses every core)"),
+	cl::init(0));
+
+static cl::opt<bool> VariableSubstitution("pta-variable-substitution",
+	cl::desc("Merge pointer-equivalent variables and drop dead constraints before solving"),
+	cl::init(true));
+
+static cl::opt<bool> FlowSensitive("pta-flow-sensitive",
+	cl::desc("Refine each function's results flow-sensitively over MemorySSA"),
+	cl::init(false));
+
+static cl::opt<bool> WholeModule("pta-whole-module",
+	cl::desc("Solve one constraint system for the whole module instead of one per function"),
+	cl::init(false));
+
+static cl::opt<std::string> CacheDir("pta-cache-dir",
+	cl::desc("Directory for cached points-to results, keyed by a hash of the IR they were computed from"),
+	cl::value_desc("directory"), cl::init(""));
+
+static cl::opt<std::string> QueryFile("pta-queries",
+	cl::desc("Answer the alias queries in this file instead of printing the a/b report"),
+	cl::value_desc("filename"), cl::init(""));
+
+static cl::opt<std::string> QueryOutput("pta-query-output",
+	cl::desc("Where to write the answers to -pta-queries"),
+	cl::value_desc("filename"), cl::init("-"));
+
+static cl::opt<std::string> CallGraphFile("pta-callgraph",
+	cl::desc("With -pta-whole-module, write the call graph with calls through pointers resolved, as DOT"),
+	cl::value_desc("filename"), cl::init(""));
+
+static cl::opt<std::string> StatsFile("pta-stats",
+	cl::desc("Write solver counters, timings and set sizes of every solve as JSON"),
+	cl::value_desc("filename"), cl::init(""));
+
+static cl::opt<std::string> SummaryFile("pta-summaries",
+	cl::desc("File with additional call summaries for the pointer analysis"),
+	cl::value_desc("filename"), cl::init(""));
+
+static cl::opt<bool> HeapCloning("pta-heap-cloning",
+	cl::desc("In whole-module mode, give each call of an allocation wrapper its own heap object"),
+	cl::init(false));
+
+static cl::opt<bool> FieldSensitive("pta-field-sensitive",
+	cl::desc("Model struct fields as separate memory objects, resolving GEPs by byte offset"),
+	cl::init(false));
+
+static cl::opt<unsigned> FieldLimit("pta-field-limit",
+	cl::desc("Objects with more fields than this are not split in field-sensitive mode"),
+	cl::init(64));
+
+static cl::opt<bool> TypeFilter("pta-type-filter",
+	cl::desc("Assume memory is accessed through its own type: ignore values that cannot carry a pointer, and GEPs into objects of unrelated types"),
+	cl::init(false));
+
+#define DEBUG_TYPE "pointer-analysis"
+STATISTIC(NumSolves, "Constraint systems solved");
+STATISTIC(NumCacheHits, "Constraint systems loaded from the cache");
+STATISTIC(NumOverBudget, "Constraint systems that went over budget and were unified");
+STATISTIC(NumRounds, "Solver rounds (worklist runs or propagation waves)");
+STATISTIC(NumNodeVisits, "Nodes visited with new targets");
+STATISTIC(NumConstraintVisits, "Constraints visited during propagation");
+STATISTIC(NumPropagated, "Targets pushed along constraints");
+STATISTIC(NumMerged, "Nodes merged by cycle detection");
+STATISTIC(NumCallTargets, "Indirect call targets resolved");
+STATISTIC(NumRegistersSplit, "Registers resolved outside the fixpoint");
+STATISTIC(MaxSetSize, "Largest points-to set");
+
+// Hash-consed storage for points-to sets. Identical sets are stored once and
+// handed out as a PtsID; set operations are memoized on their operand IDs.
+// Sets live in a deque so references returned by get() stay valid while new
+// sets are interned.
+class PtsSetPool
+{
+	std::deque<PtsSet> sets;
+	llvm::DenseMap<size_t, SmallVector<PtsID, 1>> buckets;
+	llvm::DenseMap<std::pair<PtsID, PtsID>, PtsID> unionCache, diffCache, intersectCache;
+	llvm::DenseMap<NodeID, PtsID> singletons;
+	// Dense copies of large sets, one bit per object up to the last one,
+	// for wave propagation to union with unionWords(). Interned sets never
+	// change, so a copy never goes stale. Sets too small or too sparse to be
+	// worth one map to an empty copy.
+	llvm::DenseMap<PtsID, std::vector<uint64_t>> denseSets;
+	static constexpr unsigned DenseMinSize = 128;
+	size_t setBytes = 0;
+
+	// Sets hash by their nonzero 64-bit words, so a set and its dense copy
+	// hash alike and the hash costs one combine per word, not per element.
+	static size_t hashOf(const PtsSet &set)
+	{
+		hash_code hash = hash_value(0);
+		size_t index = ~size_t(0);
+		uint64_t word = 0;
+		for (NodeID obj : set)
+		{
+			if (obj / 64 != index)
+			{
+				if (word)
+					hash = hash_combine(hash, index, word);
+				index = obj / 64;
+				word = 0;
+			}
+			word |= uint64_t(1) << (obj % 64);
+		}
+		if (word)
+			hash = hash_combine(hash, index, word);
+		return hash;
+	}
+
+	static size_t hashOf(ArrayRef<uint64_t> words)
+	{
+		hash_code hash = hash_value(0);
+		for (size_t index = 0; index < words.size(); ++index)
+			if (words[index])
+				hash = hash_combine(hash, index, words[index]);
+		return hash;
+	}
+
+	PtsID internHashed(PtsSet &&set, size_t hash)
+	{
+		auto &bucket = buckets[hash];
+		for (PtsID id : bucket)
+			if (sets[id] == set)
+				return id;
+		PtsID id = sets.size();
+		setBytes += bytesOf(set);
+		sets.push_back(std::move(set));
+		bucket.push_back(id);
+		return id;
+	}
+
+	// Heap footprint of a set: its list of fixed-size elements.
+	static size_t bytesOf(const PtsSet &set)
+	{
+		static constexpr unsigned Bits = SparseBitVectorElement<128>::BITS_PER_ELEMENT;
+		size_t elements = 0;
+		NodeID last = ~0u;
+		for (NodeID obj : set)
+			if (obj / Bits != last)
+			{
+				last = obj / Bits;
+				++elements;
+			}
+		return sizeof(PtsSet) + elements * (sizeof(SparseBitVectorElement<128>) + 2 * sizeof(void *));
+	}
+
+public:
+	static constexpr PtsID EmptySet = 0;
+
+	PtsSetPool() { intern(PtsSet()); }
+
+	PtsID intern(PtsSet &&set)
+	{
+		size_t hash = hashOf(set);
+		return internHashed(std::move(set), hash);
+	}
+
+	// Interns a set whose dense copy the caller already has, and keeps that.
+	PtsID intern(PtsSet &&set, std::vector<uint64_t> &&words)
+	{
+		PtsID id = internHashed(std::move(set), hashOf(words));
+		auto [it, inserted] = denseSets.try_emplace(id);
+		if (inserted)
+		{
+			setBytes += words.size() * sizeof(uint64_t);
+			it->second = std::move(words);
+		}
+		return id;
+	}
+
+	const PtsSet &get(PtsID id) const { return sets[id]; }
+	size_t size() const { return sets.size(); }
+
+	// Makes the dense copy of a set with enough elements, at least one in
+	// 64 bits set, if it has none yet.
+	void makeDense(PtsID id)
+	{
+		auto [it, inserted] = denseSets.try_emplace(id);
+		if (!inserted)
+			return;
+		const PtsSet &set = sets[id];
+		unsigned count = set.count();
+		if (count < DenseMinSize || uint64_t(count) * 64 <= unsigned(set.find_last()))
+			return;
+		it->second.resize(set.find_last() / 64 + 1);
+		for (NodeID obj : set)
+			it->second[obj / 64] |= uint64_t(1) << (obj % 64);
+		setBytes += it->second.size() * sizeof(uint64_t);
+	}
+
+	// The dense copy of a set, if makeDense() gave it one. Safe to call from
+	// several threads as long as nothing is interned meanwhile.
+	const std::vector<uint64_t> *denseOf(PtsID id) const
+	{
+		auto it = denseSets.find(id);
+		return it == denseSets.end() || it->second.empty() ? nullptr : &it->second;
+	}
+
+	// Approximate bytes held by the sets and the memo tables.
+	size_t memoryUsage() const
+	{
+		return setBytes + buckets.getMemorySize() + unionCache.getMemorySize() + diffCache.getMemorySize() + intersectCache.getMemorySize() + singletons.getMemorySize() + denseSets.getMemorySize();
+	}
+
+	size_t numElements() const
+	{
+		size_t total = 0;
+		for (const PtsSet &set : sets)
+			total += set.count();
+		return total;
+	}
+
+	PtsID unionOf(PtsID a, PtsID b)
+	{
+		if (a == b || b == EmptySet)
+			return a;
+		if (a == EmptySet)
+			return b;
+		if (a > b)
+			std::swap(a, b);
+		auto [it, inserted] = unionCache.try_emplace({a, b}, EmptySet);
+		if (!inserted)
+			return it->second;
+		PtsSet result = sets[a];
+		result |= sets[b];
+		PtsID id = intern(std::move(result));
+		unionCache[{a, b}] = id;
+		return id;
+	}
+
+	PtsID differenceOf(PtsID a, PtsID b)
+	{
+		if (a == b || a == EmptySet)
+			return EmptySet;
+		if (b == EmptySet)
+			return a;
+		auto [it, inserted] = diffCache.try_emplace({a, b}, EmptySet);
+		if (!inserted)
+			return it->second;
+		PtsSet result = sets[a];
+		result.intersectWithComplement(sets[b]);
+		PtsID id = intern(std::move(result));
+		diffCache[{a, b}] = id;
+		return id;
+	}
+
+	PtsID intersectionOf(PtsID a, PtsID b)
+	{
+		if (a == b)
+			return a;
+		if (a == EmptySet || b == EmptySet)
+			return EmptySet;
+		if (a > b)
+			std::swap(a, b);
+		auto [it, inserted] = intersectCache.try_emplace({a, b}, EmptySet);
+		if (!inserted)
+			return it->second;
+		PtsSet result = sets[a];
+		result &= sets[b];
+		PtsID id = intern(std::move(result));
+		intersectCache[{a, b}] = id;
+		return id;
+	}
+
+	PtsID insert(PtsID set, NodeID obj)
+	{
+		if (sets[set].test(obj))
+			return set;
+		auto [it, inserted] = singletons.try_emplace(obj, EmptySet);
+		if (inserted)
+		{
+			PtsSet single;
+			single.set(obj);
+			PtsID id = intern(std::move(single));
+			singletons[obj] = id;
+			return unionOf(set, id);
+		}
+		return unionOf(set, it->second);
+	}
+};
+
+// Steensgaard-style unification: nodes are merged into equivalence classes,
+// and each class points to at most one other class. Joining two classes joins
+// their pointees too, so every constraint costs near-constant time.
+class Unifier
+{
+	std::vector<NodeID> parent, pointees;
+
+public:
+	static constexpr NodeID None = ~0u;
+
+	explicit Unifier(unsigned numNodes) : parent(numNodes), pointees(numNodes, None)
+	{
+		for (NodeID node = 0; node < numNodes; ++node)
+			parent[node] = node;
+	}
+
+	NodeID find(NodeID node)
+	{
+		while (parent[node] != node)
+		{
+			parent[node] = parent[parent[node]];
+			node = parent[node];
+		}
+		return node;
+	}
+
+	// The class node points to, created empty on first use.
+	NodeID pointee(NodeID node)
+	{
+		node = find(node);
+		if (pointees[node] == None)
+		{
+			NodeID fresh = parent.size();
+			parent.push_back(fresh);
+			pointees.push_back(None);
+			pointees[node] = fresh;
+		}
+		return find(pointees[node]);
+	}
+
+	bool hasPointee(NodeID node) { return pointees[find(node)] != None; }
+
+	void join(NodeID a, NodeID b)
+	{
+		SmallVector<std::pair<NodeID, NodeID>, 8> pending{{a, b}};
+		while (!pending.empty())
+		{
+			auto [x, y] = pending.pop_back_val();
+			x = find(x);
+			y = find(y);
+			if (x == y)
+				continue;
+			parent[y] = x;
+			if (pointees[x] == None)
+				pointees[x] = pointees[y];
+			else if (pointees[y] != None)
+				pending.emplace_back(pointees[x], pointees[y]);
+		}
+	}
+};
+
+// What a call to a known function does to pointers. The returned pointer is
+// nothing of interest, one of the arguments, fresh memory or anything at all;
+// `copies` lists (dst, src) argument pairs whose pointees' contents are copied,
+// as memcpy does, where `Result` stands for the returned pointer. Calls with
+// a summary only get the constraints it implies.
+struct CallSummary
+{
+	enum RetKind { RetNone, RetArg, RetAlloc, RetUnknown } ret = RetNone;
+	static constexpr unsigned Result = ~0u;
+	unsigned retArg = 0;
+	SmallVector<std::pair<unsigned, unsigned>, 1> copies;
+};
+
+// One summary per line: `name ret [copy=DST:SRC]...` where ret is `none`,
+// `argN`, `alloc` or `unknown`, and DST is an argument number or `ret`.
+// Intrinsics are listed by their base name; C++ operators by their mangled
+// name. Files passed with -pta-summaries use the same format and take
+// precedence.
+static const char BuiltinSummaries[] = R"(
+malloc               alloc
+calloc               alloc
+realloc              alloc copy=ret:0
+reallocarray         alloc copy=ret:0
+aligned_alloc        alloc
+_Znwm                alloc
+_Znam                alloc
+_Znwj                alloc
+_Znaj                alloc
+_ZnwmRKSt9nothrow_t  alloc
+_ZnamRKSt9nothrow_t  alloc
+_ZnwmSt11align_val_t alloc
+_ZnamSt11align_val_t alloc
+free                 none
+memcpy               arg0 copy=0:1
+memmove              arg0 copy=0:1
+memset               arg0
+memcmp               none
+memchr               arg0
+strlen               none
+strnlen              none
+strcmp               none
+strncmp              none
+strcpy               arg0
+strncpy              arg0
+strcat               arg0
+strncat              arg0
+strchr               arg0
+strrchr              arg0
+strstr               arg0
+strpbrk              arg0
+strdup               alloc
+strndup              alloc
+printf               none
+fprintf              none
+sprintf              none
+snprintf             none
+puts                 none
+putchar              none
+llvm.memcpy          none copy=0:1
+llvm.memcpy.inline   none copy=0:1
+llvm.memmove         none copy=0:1
+llvm.memset          none
+llvm.memset.inline   none
+llvm.lifetime.start  none
+llvm.lifetime.end    none
+)";
+
+static void parseSummaries(StringRef text, StringRef source, StringMap<CallSummary> &table)
+{
+	SmallVector<StringRef, 8> lines;
+	text.split(lines, '\n');
+	for (unsigned lineNo = 0; lineNo < lines.size(); ++lineNo)
+	{
+		StringRef line = lines[lineNo].split('#').first.trim();
+		if (line.empty())
+			continue;
+
+		SmallVector<StringRef, 4> fields;
+		SplitString(line, fields);
+		auto fail = [&](const Twine &msg)
+		{
+			errs() << source << ":" << lineNo + 1 << ": " << msg << ", summary ignored\n";
+		};
+		if (fields.size() < 2)
+		{
+			fail("expected `name ret`");
+			continue;
+		}
+
+		CallSummary summary;
+		StringRef ret = fields[1];
+		if (ret == "none")
+			summary.ret = CallSummary::RetNone;
+		else if (ret == "alloc")
+			summary.ret = CallSummary::RetAlloc;
+		else if (ret == "unknown")
+			summary.ret = CallSummary::RetUnknown;
+		else if (ret.consume_front("arg") && !ret.getAsInteger(10, summary.retArg))
+			summary.ret = CallSummary::RetArg;
+		else
+		{
+			fail("unknown return kind '" + fields[1] + "'");
+			continue;
+		}
+
+		bool valid = true;
+		for (StringRef field : ArrayRef<StringRef>(fields).drop_front(2))
+		{
+			auto [dst, src] = field.split(':');
+			unsigned dstArg = CallSummary::Result, srcArg;
+			if (!dst.consume_front("copy=") || (dst != "ret" && dst.getAsInteger(10, dstArg)) || src.getAsInteger(10, srcArg))
+			{
+				fail("malformed effect '" + field + "'");
+				valid = false;
+				break;
+			}
+			summary.copies.emplace_back(dstArg, srcArg);
+		}
+		if (valid)
+			table[fields[0]] = std::move(summary);
+	}
+}
+
+static const StringMap<CallSummary> &getCallSummaries()
+{
+	static const StringMap<CallSummary> table = []
+	{
+		StringMap<CallSummary> table;
+		parseSummaries(BuiltinSummaries, "<builtin summaries>", table);
+		if (!SummaryFile.empty())
+		{
+			auto buffer = MemoryBuffer::getFile(SummaryFile);
+			if (!buffer)
+				errs() << "pointer-analysis: cannot read " << SummaryFile << ": " << buffer.getError().message() << "\n";
+			else
+				parseSummaries((*buffer)->getBuffer(), SummaryFile, table);
+		}
+		return table;
+	}();
+	return table;
+}
+
+static bool containsPointer(Type *ty)
+{
+	if (ty->isPtrOrPtrVectorTy())
+		return true;
+	if (auto *arrayTy = dyn_cast<ArrayType>(ty))
+		return containsPointer(arrayTy->getElementType());
+	if (auto *structTy = dyn_cast<StructType>(ty))
+		return any_of(structTy->elements(), containsPointer);
+	return false;
+}
+
+// Type filtering (-pta-type-filter) assumes the type rules of C: memory is
+// only accessed through its own type or as bytes. With opaque pointers all
+// pointers have one type, and LLVM moves pointers around as integers of
+// pointer size (when it lowers a memcpy, say), so those count as pointers.
+static bool isPointerLike(Type *ty, const DataLayout &DL)
+{
+	return ty->isPointerTy() || ty->isIntegerTy(DL.getPointerSizeInBits());
+}
+
+// Whether a value of type ty may hold a pointer or part of one: a pointer,
+// an integer at least as wide, or a byte.
+static bool mayCarryPointer(Type *ty, const DataLayout &DL)
+{
+	if (ty->isPtrOrPtrVectorTy())
+		return true;
+	if (auto *intTy = dyn_cast<IntegerType>(ty->getScalarType()))
+		return intTy->getBitWidth() == 8 || intTy->getBitWidth() >= DL.getPointerSizeInBits();
+	if (auto *arrayTy = dyn_cast<ArrayType>(ty))
+		return mayCarryPointer(arrayTy->getElementType(), DL);
+	if (auto *structTy = dyn_cast<StructType>(ty))
+		return any_of(structTy->elements(), [&](Type *elemTy) { return mayCarryPointer(elemTy, DL); });
+	return false;
+}
+
+// Whether an object of type outer has a part of type inner, itself
+// included.
+static bool typeContains(Type *outer, Type *inner, const DataLayout &DL)
+{
+	if (outer == inner || (isPointerLike(outer, DL) && isPointerLike(inner, DL)))
+		return true;
+	if (auto *arrayTy = dyn_cast<ArrayType>(outer))
+		return typeContains(arrayTy->getElementType(), inner, DL);
+	if (auto *vectorTy = dyn_cast<VectorType>(outer))
+		return typeContains(vectorTy->getElementType(), inner, DL);
+	if (auto *structTy = dyn_cast<StructType>(outer))
+		return any_of(structTy->elements(), [&](Type *elemTy) { return typeContains(elemTy, inner, DL); });
+	return false;
+}
+
+// Byte offset a GEP adds to its base, or AnyOffset when an index is variable.
+static constexpr int64_t AnyOffset = INT64_MIN;
+
+static int64_t gepOffset(const GEPOperator &gep, const DataLayout &DL)
+{
+	APInt offset(DL.getIndexTypeSizeInBits(gep.getType()), 0);
+	if (!gep.accumulateConstantOffset(DL, offset))
+		return AnyOffset;
+	return offset.getSExtValue();
+}
+
+// Whether GEPs stay GEP constraints rather than becoming copies: fields
+// need their offsets, and the type filter checks each GEP's indexed type.
+// Objects have a single field without -pta-field-sensitive, so a GEP then
+// reaches the same objects as a copy, minus those the filter drops.
+static bool keepGeps()
+{
+	return FieldSensitive || TypeFilter;
+}
+
+// Leaf fields of ty with their byte offsets. Nested structs are flattened;
+// arrays are kept whole, so all their elements share one field.
+static void flattenFields(Type *ty, uint64_t offset, const DataLayout &DL, SmallVectorImpl<std::pair<uint64_t, Type *>> &fields)
+{
+	auto *structTy = dyn_cast<StructType>(ty);
+	if (!structTy)
+	{
+		fields.emplace_back(offset, ty);
+		return;
+	}
+	const StructLayout *layout = DL.getStructLayout(structTy);
+	for (unsigned i = 0; i < structTy->getNumElements(); ++i)
+		flattenFields(structTy->getElementType(i), offset + layout->getElementOffset(i), DL, fields);
+}
+
+// Kinds of constraint, for PointerAnalysis::update(). GEPs only differ from
+// copies in field-sensitive mode.
+enum class ConstraintKind { AddressOf, Copy, Load, Store, Gep };
+
+// Constraints of one kind as two parallel arrays of node IDs, so the solver
+// streams through 8 bytes per constraint.
+struct ConstraintList
+{
+	std::vector<NodeID> dsts, srcs;
+	// How many more times normalize() saw each (dst, src) key, so that
+	// removing one copy of a duplicate keeps the constraint.
+	llvm::DenseMap<uint64_t, unsigned> duplicates;
+
+	size_t size() const { return dsts.size(); }
+	void add(NodeID dst, NodeID src)
+	{
+		dsts.push_back(dst);
+		srcs.push_back(src);
+	}
+
+	// Index range of the constraints writing dst, once normalized.
+	std::pair<size_t, size_t> writing(NodeID dst) const
+	{
+		auto [lo, hi] = std::equal_range(dsts.begin(), dsts.end(), dst);
+		return {size_t(lo - dsts.begin()), size_t(hi - dsts.begin())};
+	}
+
+	// Drops one (dst, src) constraint; returns false if there is none.
+	bool remove(NodeID dst, NodeID src)
+	{
+		auto dup = duplicates.find((uint64_t)dst << 32 | src);
+		if (dup != duplicates.end())
+		{
+			if (--dup->second == 0)
+				duplicates.erase(dup);
+			return true;
+		}
+		for (size_t i = 0; i < size(); ++i)
+			if (dsts[i] == dst && srcs[i] == src)
+			{
+				dsts.erase(dsts.begin() + i);
+				srcs.erase(srcs.begin() + i);
+				return true;
+			}
+		return false;
+	}
+
+	// Sorts by (dst, src) and drops duplicates.
+	void normalize()
+	{
+		std::vector<uint64_t> keys(size());
+		for (size_t i = 0; i < size(); ++i)
+			keys[i] = (uint64_t)dsts[i] << 32 | srcs[i];
+		llvm::sort(keys);
+		for (size_t i = 1; i < keys.size(); ++i)
+			if (keys[i] == keys[i - 1])
+				++duplicates[keys[i]];
+		keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+		dsts.resize(keys.size());
+		srcs.resize(keys.size());
+		for (size_t i = 0; i < keys.size(); ++i)
+		{
+			dsts[i] = keys[i] >> 32;
+			srcs[i] = (NodeID)keys[i];
+		}
+	}
+};
+
+// Source-level names, built once per module: globals by name and, per
+// function, the variables its debug records describe, which shadow globals.
+// Objects print as their IR name or, failing that, as a variable naming them.
+class NameIndex
+{
+	StringMap<const Value *> globals;
+	llvm::DenseMap<const Function *, StringMap<const Value *>> locals;
+	llvm::DenseMap<const Value *, std::string> variableOf;
+
+public:
+	explicit NameIndex(const Module &M)
+	{
+		for (const GlobalVariable &gv : M.globals())
+			if (gv.hasName())
+				globals[gv.getName()] = &gv;
+
+		for (const Function &F : M)
+		{
+			StringMap<const Value *> &vars = locals[&F];
+			for (const BasicBlock &BB : F)
+				for (const Instruction &I : BB)
+					for (DbgVariableRecord &DVR : filterDbgVars(I.getDbgRecordRange()))
+						vars[DVR.getVariable()->getName()] = DVR.getAddress();
+			// With several variables on one object the alphabetically smallest
+			// name wins, so the choice does not depend on StringMap order.
+			for (const auto &entry : vars)
+			{
+				auto [it, inserted] = variableOf.try_emplace(entry.second, entry.first().str());
+				if (!inserted && entry.first() < it->second)
+					it->second = entry.first().str();
+			}
+		}
+	}
+
+	const Value *lookup(const Function &F, StringRef name) const
+	{
+		auto fn = locals.find(&F);
+		if (fn != locals.end())
+		{
+			auto it = fn->second.find(name);
+			if (it != fn->second.end())
+				return it->second;
+		}
+		return globals.lookup(name);
+	}
+
+	StringRef nameOf(const Value *val) const
+	{
+		if (!val)
+			return StringRef();
+		if (val->hasName())
+			return val->getName();
+		auto it = variableOf.find(val);
+		return it == variableOf.end() ? StringRef() : StringRef(it->second);
+	}
+};
+
+static void printObjects(raw_ostream &os, ArrayRef<std::string> names)
+{
+	os << "{ ";
+	for (const std::string &name : names)
+		os << name << " ";
+	os << "}";
+}
 
 class PointerAnalysis
 {
+	friend class FlowSensitiveAnalysis;
 
-	const Function &Fn;
+	const Module &M;
+	bool wholeModule = false;
+	// Solve by unification instead of inclusion; see solveByUnification().
+	bool unification = false;
+
+	// Open-world mode, used when answering alias queries: code outside the
+	// function may run at opaque calls and see whatever escapes, so pointers
+	// the builder cannot explain point to the unknown object instead of to
+	// nothing. `escapes` collects pointers handed to calls or returned.
+	bool openWorld = false;
+	bool clobbersMemory = false;
+	std::vector<NodeID> escapes;
+	std::optional<PtsSet> exposed;
 	SmallPtrSet<const Value *, 32> memObj;
-	SmallVector<std::pair<const Value *, const Value *>, 128> copy, load, store;
+	llvm::DenseMap<const Function *, SmallVector<const CallInst *, 1>> wrappers;
+	// Constraints are recorded on node IDs as they are collected. In each
+	// list the first operand is the side being written: `addr` is
+	// (dest, object), `copy` (dest, src), `load` (dest, ptr), `store`
+	// (ptr, val) and `transfer` (dst, src) for calls like memcpy that copy the
+	// contents of *src into *dst.
+	ConstraintList addr, copy, load, store, transfer;
+	// Values that may point anywhere (inttoptr, results of unknown calls).
+	std::vector<NodeID> unknown;
+	// Field-sensitive mode only: dest = src + offset, resolved per target of
+	// src. GEPs land here, as do pointers returned into an argument's object.
+	struct FieldEdge
+	{
+		NodeID dest, src;
+		int64_t offset;
+	};
+	SmallVector<FieldEdge, 32> geps;
+
+	// What offline substitution did, for update(): the constraints it dropped
+	// may fire once constraints are added, and its merges are kept when
+	// copy cycles are split again.
+	struct NodeConstraint
+	{
+		ConstraintKind kind;
+		NodeID dst, src;
+		int64_t offset;
+	};
+	std::vector<NodeConstraint> dropped;
+	std::vector<NodeID> offlineRep;
+	BitVector offlineMerged;
+
+	static constexpr NodeID NoObj = ~0u;
+
+	std::vector<const Value *> nodeValues;
+	llvm::DenseMap<const Value *, NodeID> nodeIDs;
+	unsigned numObjects = 0;
+
+	// Per object: in field-sensitive mode a struct object is split into one
+	// object per leaf field. The fields of an object are numbered
+	// contiguously from its base node, which is also its first field.
+	struct ObjectField
+	{
+		NodeID base;
+		unsigned count;
+		uint64_t start, baseSize;
+		Type *type;
+	};
+	std::vector<ObjectField> objFields;
+	// Fields some pointer may point into the middle of rather than at their
+	// first byte, found as GEPs are resolved. An access through a pointer to
+	// one may start anywhere in it; see widenFields().
+	BitVector interiorFields;
+	// Type filtering: per type a GEP steps over, the objects it may index
+	// into. See mayIndex().
+	llvm::DenseMap<Type *, BitVector> indexableObjects;
+
+	// The unknown object stands for "any memory object", so a value that may
+	// point anywhere gets one target instead of a copy edge per object. Its own
+	// node summarizes the contents of every object and `unknownStore` collects
+	// what is stored through it; both are wired to the real objects only once,
+	// the first time a load or store actually goes through the unknown object.
+	NodeID unknownObj = NoObj, unknownStore = NoObj;
+	bool unknownLoadsBound = false, unknownStoresBound = false;
+
+	NodeID getNode(const Value *val)
+	{
+		auto [it, inserted] = nodeIDs.try_emplace(val, nodeValues.size());
+		if (inserted)
+			nodeValues.push_back(val);
+		return it->second;
+	}
+
+	// Nodes without a Value of their own, used for summaries and temporaries.
+	NodeID newNode()
+	{
+		nodeValues.push_back(nullptr);
+		return nodeValues.size() - 1;
+	}
+
+	void addConstraint(ConstraintList &list, const Value *dst, const Value *src)
+	{
+		list.add(getNode(dst), getNode(src));
+	}
+
+	void addMemObj(const Value *obj)
+	{
+		if (!memObj.insert(obj).second)
+			return;
+		NodeID base = getNode(obj);
+		Type *ty = getType(obj);
+		const DataLayout &DL = M.getDataLayout();
+
+		SmallVector<std::pair<uint64_t, Type *>, 8> layout;
+		if (FieldSensitive && isa_and_nonnull<StructType>(ty) && ty->isSized() && !DL.getTypeAllocSize(ty).isScalable())
+			flattenFields(ty, 0, DL, layout);
+		if (layout.size() < 2 || layout.size() > FieldLimit)
+		{
+			objFields.push_back({base, 1, 0, 0, ty});
+			return;
+		}
+
+		uint64_t size = DL.getTypeAllocSize(ty).getFixedValue();
+		for (unsigned i = 0; i < layout.size(); ++i)
+		{
+			if (i > 0)
+				newNode();
+			objFields.push_back({base, (unsigned)layout.size(), layout[i].first, size, layout[i].second});
+		}
+	}
+
+	// Closes the object ID range; the unknown object is the last object and has
+	// no Value of its own.
+	void finishObjects()
+	{
+		unknownObj = nodeValues.size();
+		nodeValues.push_back(nullptr);
+		objFields.push_back({unknownObj, 1, 0, 0, nullptr});
+		numObjects = nodeValues.size();
+		interiorFields.resize(numObjects);
+	}
+
+	// The field of obj's object found `offset` bytes past obj, or NoObj when
+	// the offset is unknown or leaves the object. Unsplit objects are their
+	// own only field.
+	NodeID fieldAt(NodeID obj, int64_t offset)
+	{
+		const ObjectField &field = objFields[obj];
+		if (field.count == 1)
+			return obj;
+		if (offset == AnyOffset)
+			return NoObj;
+		int64_t pos = field.start + offset;
+		if (pos < 0 || (uint64_t)pos >= field.baseSize)
+			return NoObj;
+		NodeID node = field.base;
+		while (node + 1 < field.base + field.count && objFields[node + 1].start <= (uint64_t)pos)
+			++node;
+		return node;
+	}
+
+	// A constant address into a memory object, such as a constant GEP on a
+	// global, resolved to the field it points into.
+	NodeID constantField(const Value *val)
+	{
+		if (!isa_and_nonnull<Constant>(val) || !val->getType()->isPointerTy())
+			return NoObj;
+		const DataLayout &DL = M.getDataLayout();
+		APInt offset(DL.getIndexTypeSizeInBits(val->getType()), 0);
+		const Value *base = val->stripAndAccumulateConstantOffsets(DL, offset, /*AllowNonInbounds=*/true);
+		if (!memObj.count(base))
+			return NoObj;
+		NodeID obj = nodeIDs.lookup(base);
+		NodeID field = fieldAt(obj, offset.getSExtValue());
+		if (field == NoObj)
+			return obj;
+		if (objFields[field].start != offset.getZExtValue())
+			interiorFields.set(field);
+		return field;
+	}
 
 	const Value *getPtrObj(const Value *val)
 	{
@@ -29,368 +971,3648 @@ class PointerAnalysis
 		return nullptr;
 	}
 
-	bool insertIfAbsent(SmallPtrSet<const Value *, 8> &set, const Value *val){
-		if (!set.count(val))
+	Type *getType(const Value *memObj)
+	{
+		if (const AllocaInst *alloc = dyn_cast<AllocaInst>(memObj))
+			return alloc->getAllocatedType();
+		else if (const GlobalVariable *globalvar = dyn_cast<GlobalVariable>(memObj))
+			return globalvar->getValueType();
+		return nullptr;
+	}
+
+	const Value *getPtrOpd(const Constant *cons)
+	{
+		if (!cons)
+			return nullptr;
+		if (auto *constt = dyn_cast<ConstantExpr>(cons))
+		{
+			if (constt->getOpcode() == Instruction::BitCast || constt->getOpcode() == Instruction::GetElementPtr)
+			{
+				if (auto *op = dyn_cast<Constant>(constt->getOperand(0)))
+					return getPtrOpd(op);
+			}
+		}
+		else if (getPtrObj(cons))
+		{
+			return cons;
+		}
+		return nullptr;
+	}
+
+	// Solver state, indexed by NodeID. Points-to sets are PtsIDs into `pool`,
+	// so nodes with identical sets share one copy. `propagated` remembers, per
+	// node, the part of its set that has already been pushed along its
+	// outgoing edges, so each visit only moves the delta.
+	PtsSetPool pool;
+	std::vector<PtsID> pointsTo, propagated;
+	std::vector<SparseBitVector<>> copySuccs;
+	std::vector<SmallVector<NodeID, 2>> loadsFrom, storesTo;
+	std::vector<SmallVector<std::pair<NodeID, int64_t>, 1>> gepsFrom;
+	std::vector<NodeID> directObjs;
+	BitVector holdsPointers;
+	SmallVector<NodeID, 64> worklist;
+	BitVector inWorklist;
+
+	// Lazy cycle detection: nodes found on a copy cycle are collapsed into a
+	// single representative. `rep` is the union-find parent of each node and
+	// `checkedEdges` keeps each edge from triggering more than one search.
+	std::vector<NodeID> rep;
+	llvm::DenseSet<std::pair<NodeID, NodeID>> checkedEdges;
+	// Set whenever an edge or a target is added; wave propagation runs until
+	// a round of complex constraints leaves it clear.
+	bool graphGrew = false;
+
+	// Demand-driven mode: seeds go in up front, but the constraints writing
+	// a node are only wired once a query needs that node, so each query
+	// solves the part of the graph its answer depends on. Solved parts stay
+	// solved for later queries. `active` marks the nodes wired so far and
+	// `toWire` those still to do. Stores are indexed by the object they
+	// write: `directStores` by their direct object, `indirectStores` are the
+	// rest, matched against their pointer's targets.
+	bool demandDriven = false;
+	BitVector active;
+	SmallVector<NodeID, 16> toWire;
+	bool wiring = false, storePtrsActive = false;
+	ConstraintList directStores, indirectStores;
+
+	// Whole-module mode: calls through a pointer are bound to their callees
+	// as the pointer's targets are found. `callsFrom` indexes them by the
+	// representative of the callee pointer, `boundCalls` holds the (call,
+	// target) pairs done so far and `callConstraints` what binding them
+	// added, for removeConstraints() to replay.
+	struct IndirectCall
+	{
+		const CallInst *call;
+		NodeID callee;
+	};
+	std::vector<IndirectCall> indirectCalls;
+	std::vector<SmallVector<unsigned, 1>> callsFrom;
+	llvm::DenseSet<std::pair<unsigned, NodeID>> boundCalls;
+	std::vector<NodeConstraint> callConstraints;
+
+	// Partial SSA: registers taken out of the graph by splitTopLevel(). Each
+	// has the `objects` it gets directly and whatever the nodes in `sources`
+	// end up with; as a pointer operand it also stands for its direct object.
+	struct Register
+	{
+		PtsID objects;
+		SmallVector<NodeID, 4> sources;
+	};
+	llvm::DenseMap<NodeID, Register> registers;
+
+	// Budget governor: a system whose sets outgrow -pta-memory-budget, or
+	// whose solve outlasts -pta-visit-budget node visits, is solved again
+	// by unification; see degrade(). Visits are counted whether or not the
+	// solver is instrumented. Budgets only hold during the initial
+	// exhaustive solve (`budgeted`): once results are handed out, set IDs
+	// and references into the pool must stay valid, so demand-driven
+	// queries and update() are never cut short. `function` is only used to
+	// name the system in the warning and is null in whole-module mode.
+	const Function *function = nullptr;
+	uint64_t visitCount = 0;
+	bool budgeted = false;
+
+	// Solver instrumentation for -stats and -pta-stats. Visits count the
+	// constraints a node's new targets were pushed along, and with the
+	// seconds are indexed by ConstraintKind. Timing only happens when
+	// `instrumented` is set.
+	struct SolverStats
+	{
+		uint64_t rounds = 0, nodeVisits = 0, propagated = 0, merged = 0;
+		uint64_t visits[5] = {};
+		double seconds[5] = {};
+		double solveSeconds = 0;
+		size_t constraints = 0;
+		bool cached = false, overBudget = false;
+	};
+	bool instrumented = false;
+	SolverStats stats;
+
+	NodeID find(NodeID node)
+	{
+		while (rep[node] != node)
+		{
+			rep[node] = rep[rep[node]];
+			node = rep[node];
+		}
+		return node;
+	}
+
+	void enqueue(NodeID node)
+	{
+		if (!inWorklist.test(node))
+		{
+			inWorklist.set(node);
+			worklist.push_back(node);
+		}
+	}
+
+	// Grows the set of a representative node; returns true if it changed.
+	bool unionInto(NodeID dest, PtsID set)
+	{
+		PtsID merged = pool.unionOf(pointsTo[dest], set);
+		if (merged == pointsTo[dest])
+			return false;
+		pointsTo[dest] = merged;
+		return true;
+	}
+
+	// Adds the inclusion edge pointsTo[dst] ⊇ pointsTo[src]. A freshly added edge
+	// has never seen what src already propagated, so that part is pushed now.
+	void addCopyEdge(NodeID src, NodeID dest)
+	{
+		src = find(src);
+		dest = find(dest);
+		if (src == dest || !copySuccs[src].test_and_set(dest))
+			return;
+		graphGrew = true;
+		if (unionInto(dest, propagated[src]))
+			enqueue(dest);
+	}
+
+	void addPtrObj(NodeID obj, NodeID dest)
+	{
+		dest = find(dest);
+		PtsID grown = pool.insert(pointsTo[dest], obj);
+		if (grown != pointsTo[dest])
+		{
+			pointsTo[dest] = grown;
+			graphGrew = true;
+			enqueue(dest);
+		}
+	}
+
+	// The field `offset` bytes into obj, or NoObj for every field of obj's
+	// object when that cannot be pinned down: the offset is unknown, leaves
+	// the object, or starts from a pointer that may be in the middle of obj
+	// (`exact` says it is at obj's first byte). Marks the fields the result
+	// may point into the middle of.
+	NodeID resolveField(NodeID obj, int64_t offset, bool exact)
+	{
+		const ObjectField &info = objFields[obj];
+		NodeID field = interiorFields.test(obj) && !exact ? NoObj : fieldAt(obj, offset);
+		if (field == NoObj)
+			interiorFields.set(info.base, info.base + info.count);
+		else if (info.count > 1 && objFields[field].start != info.start + offset)
+			interiorFields.set(field);
+		return field;
+	}
+
+	// dest gets the field `offset` bytes into obj, or every field of obj's
+	// object when that cannot be pinned down.
+	void addFieldPtr(NodeID obj, int64_t offset, NodeID dest, bool exact = false)
+	{
+		if (TypeFilter && !mayIndex(obj, dest))
+			return;
+		NodeID field = resolveField(obj, offset, exact);
+		if (field != NoObj)
+		{
+			addPtrObj(field, dest);
+			return;
+		}
+		const ObjectField &info = objFields[obj];
+		for (NodeID node = info.base; node < info.base + info.count; ++node)
+			addPtrObj(node, dest);
+	}
+
+	// Whether the GEP writing dest may step into obj's object: one of the
+	// object's type and the type the GEP indexes over contains the other,
+	// as with arrays, nested structs and C-style derived structs. GEPs over
+	// bytes, and objects with no declared type such as heap objects, are
+	// never filtered.
+	bool mayIndex(NodeID obj, NodeID dest)
+	{
+		auto *gep = dyn_cast_or_null<GEPOperator>(nodeValues[dest]);
+		if (!gep || gep->getSourceElementType()->isIntegerTy(8))
+			return true;
+		Type *indexed = gep->getSourceElementType();
+		auto [it, inserted] = indexableObjects.try_emplace(indexed);
+		if (inserted)
+		{
+			const DataLayout &DL = M.getDataLayout();
+			it->second.resize(numObjects);
+			for (NodeID node = 0; node < numObjects; ++node)
+			{
+				const Value *base = nodeValues[objFields[node].base];
+				Type *objTy = base ? getType(base) : nullptr;
+				if (!objTy || typeContains(objTy, indexed, DL) || typeContains(indexed, objTy, DL))
+					it->second.set(node);
+			}
+		}
+		return it->second.test(obj);
+	}
+
+	// *dst = *src goes through a temporary: temp = *src; *dst = temp. With
+	// fields, the copy may cover the whole object, so it goes between
+	// pointers to every field of both sides.
+	void lowerTransfers()
+	{
+		for (size_t i = 0; i < transfer.size(); ++i)
+		{
+			NodeID dst = transfer.dsts[i], src = transfer.srcs[i];
+			if (FieldSensitive)
+			{
+				NodeID srcFields = newNode(), dstFields = newNode();
+				geps.push_back({srcFields, src, AnyOffset});
+				geps.push_back({dstFields, dst, AnyOffset});
+				src = srcFields;
+				dst = dstFields;
+			}
+			NodeID temp = newNode();
+			load.add(temp, src);
+			store.add(dst, temp);
+		}
+		transfer = ConstraintList();
+	}
+
+	// Extends the per-node tables to nodes numbered since the last call.
+	void growTables()
+	{
+		unsigned first = rep.size(), numNodes = nodeValues.size();
+		pointsTo.resize(numNodes, PtsSetPool::EmptySet);
+		propagated.resize(numNodes, PtsSetPool::EmptySet);
+		copySuccs.resize(numNodes);
+		loadsFrom.resize(numNodes);
+		storesTo.resize(numNodes);
+		gepsFrom.resize(numNodes);
+		callsFrom.resize(numNodes);
+		inWorklist.resize(numNodes);
+		active.resize(numNodes);
+		rep.resize(numNodes);
+		directObjs.resize(numNodes, NoObj);
+		for (NodeID node = first; node < numNodes; ++node)
+		{
+			rep[node] = node;
+			if (const Value *direct = getPtrObj(nodeValues[node]))
+				directObjs[node] = nodeIDs.lookup(direct);
+			else if (FieldSensitive)
+				directObjs[node] = constantField(nodeValues[node]);
+		}
+	}
+
+	// Adds the synthetic nodes, sorts and deduplicates the constraint lists
+	// and sizes the per-node tables.
+	void initNodes()
+	{
+		unknownStore = newNode();
+		lowerTransfers();
+		for (ConstraintList *list : {&addr, &copy, &load, &store})
+			list->normalize();
+		growTables();
+
+		holdsPointers.resize(numObjects);
+		holdsPointers.set(unknownObj);
+		// Without type guarantees any object may have a pointer stored into it.
+		if (openWorld)
+			holdsPointers.set(0, numObjects);
+		for (NodeID obj = 0; obj < numObjects; ++obj)
+		{
+			if (obj == unknownObj || isa_and_nonnull<Function>(nodeValues[obj]))
+				continue;
+			// Split fields have their leaf type; objects left whole in
+			// field-sensitive mode may still hold pointers inside aggregates.
+			// Heap objects have no type and may hold anything.
+			Type *ht = objFields[obj].type;
+			if (!ht || (FieldSensitive ? containsPointer(ht) : ht->isPointerTy()))
+				holdsPointers.set(obj);
+		}
+	}
+
+	// The solver treats a memory object used as a pointer operand as pointing to
+	// itself. Those direct targets never change, so they are resolved once here
+	// and only the pointsTo part is tracked by the worklist.
+	void initConstraints()
+	{
+		initSeeds();
+
+		for (size_t i = 0; i < copy.size(); ++i)
+			if (!registers.count(copy.dsts[i]))
+				addCopy(copy.dsts[i], copy.srcs[i]);
+
+		for (size_t i = 0; i < load.size(); ++i)
+			addLoad(load.dsts[i], load.srcs[i]);
+
+		for (size_t i = 0; i < store.size(); ++i)
+			addStore(store.dsts[i], store.srcs[i]);
+
+		for (const FieldEdge &gep : geps)
+			addGep(gep.dest, gep.src, gep.offset);
+
+		initCalls();
+
+		for (NodeID node = 0; node < pointsTo.size(); ++node)
+			if (pointsTo[node] != PtsSetPool::EmptySet)
+				enqueue(node);
+	}
+
+	void initSeeds()
+	{
+		// Registers already have their seeds in their objects.
+		for (size_t i = 0; i < addr.size(); ++i)
+			if (!registers.count(addr.dsts[i]))
+				addPtrObj(directObjs[addr.srcs[i]], addr.dsts[i]);
+
+		for (NodeID node : unknown)
+			if (!registers.count(node))
+				addPtrObj(unknownObj, node);
+
+		if (openWorld)
+			initOpenWorld();
+	}
+
+	// Demand-driven counterpart of initConstraints(): only the seeds go in,
+	// and the other constraints are indexed by the node they write for
+	// wire() to pick up.
+	void initDemand()
+	{
+		initSeeds();
+		llvm::sort(geps, [](const FieldEdge &a, const FieldEdge &b) { return a.dest < b.dest; });
+		for (size_t i = 0; i < store.size(); ++i)
+		{
+			NodeID ptr = store.dsts[i], srcVal = store.srcs[i];
+			if (directObjs[ptr] != NoObj)
+				directStores.add(directObjs[ptr], srcVal);
+			if (!isExactAddress(ptr))
+			{
+				storesTo[ptr].push_back(srcVal);
+				indirectStores.add(ptr, srcVal);
+			}
+		}
+		directStores.normalize();
+
+		// A call is only bound once its callee pointer is solved, and what
+		// it binds may be needed anywhere.
+		initCalls();
+		for (const IndirectCall &site : indirectCalls)
+			activate(site.callee);
+	}
+
+	void initCalls()
+	{
+		for (unsigned site = 0; site < indirectCalls.size(); ++site)
+			callsFrom[find(indirectCalls[site].callee)].push_back(site);
+	}
+
+	// Globals may be written by other code at any time, constant pointer
+	// operands (e.g. constant GEPs) point into their base object, and after an
+	// opaque call anything may have been stored anywhere.
+	void initOpenWorld()
+	{
+		for (NodeID obj = 0; obj < numObjects; ++obj)
+			if (isa_and_nonnull<GlobalVariable>(nodeValues[objFields[obj].base]))
+				addPtrObj(unknownObj, obj);
+
+		for (NodeID node = 0; node < nodeValues.size(); ++node)
+		{
+			const Value *val = nodeValues[node];
+			if (directObjs[node] != NoObj || !isa_and_nonnull<Constant>(val) || !val->getType()->isPointerTy())
+				continue;
+			if (isa<ConstantPointerNull>(val) || isa<UndefValue>(val))
+				continue;
+			NodeID field = constantField(val);
+			if (field == NoObj)
+			{
+				const Value *base = getUnderlyingObject(val);
+				field = memObj.count(base) ? nodeIDs.lookup(base) : unknownObj;
+			}
+			addPtrObj(field, node);
+		}
+
+		if (clobbersMemory)
+		{
+			addPtrObj(unknownObj, unknownStore);
+			bindUnknownStores();
+		}
+	}
+
+	// The printed report keeps the historic reading where a memory object used
+	// as a pointer operand also passes on its contents. Alias queries and
+	// field offsets need the exact one: an object's address points to that
+	// object and nothing else.
+	bool isExactAddress(NodeID node)
+	{
+		return (openWorld || FieldSensitive || unification) && node < numObjects;
+	}
+
+	void addCopy(NodeID dest, NodeID src)
+	{
+		if (auto reg = registers.find(src); reg != registers.end())
+		{
+			for (NodeID obj : registerTargets(src))
+				addPtrObj(obj, dest);
+			for (NodeID srcNode : reg->second.sources)
+				addCopyEdge(srcNode, dest);
+			return;
+		}
+		if (directObjs[src] != NoObj)
+			addPtrObj(directObjs[src], dest);
+		if (!isExactAddress(src))
+			addCopyEdge(src, dest);
+	}
+
+	void addGep(NodeID dest, NodeID src, int64_t offset)
+	{
+		if (auto reg = registers.find(src); reg != registers.end())
+		{
+			for (NodeID obj : registerTargets(src))
+				addFieldPtr(obj, offset, dest);
+			for (NodeID srcNode : reg->second.sources)
+				gepsFrom[find(srcNode)].emplace_back(dest, offset);
+			return;
+		}
+		// The address of an object itself is at its first byte.
+		if (directObjs[src] != NoObj)
+			addFieldPtr(directObjs[src], offset, dest, getPtrObj(nodeValues[src]));
+		if (!isExactAddress(src))
+			gepsFrom[find(src)].emplace_back(dest, offset);
+	}
+
+	void addLoad(NodeID dest, NodeID ptr)
+	{
+		if (auto reg = registers.find(ptr); reg != registers.end())
+		{
+			for (NodeID obj : registerTargets(ptr))
+			{
+				if (obj == unknownObj)
+					bindUnknownLoads();
+				addCopyEdge(obj, dest);
+			}
+			for (NodeID srcNode : reg->second.sources)
+				loadsFrom[find(srcNode)].push_back(dest);
+			return;
+		}
+		if (directObjs[ptr] != NoObj)
+			addCopyEdge(directObjs[ptr], dest);
+		if (!isExactAddress(ptr))
+			loadsFrom[find(ptr)].push_back(dest);
+	}
+
+	void addStore(NodeID ptr, NodeID srcVal)
+	{
+		if (auto reg = registers.find(ptr); reg != registers.end())
+		{
+			for (NodeID obj : registerTargets(ptr))
+				storeInto(obj, srcVal);
+			for (NodeID srcNode : reg->second.sources)
+				storesTo[find(srcNode)].push_back(srcVal);
+			return;
+		}
+		if (directObjs[ptr] != NoObj)
+			storeInto(directObjs[ptr], srcVal);
+		if (!isExactAddress(ptr))
+			storesTo[find(ptr)].push_back(srcVal);
+	}
+
+	// Variants for a graph that is already being solved: the pointer may
+	// have propagated targets before the constraint was added, so those are
+	// caught up on here.
+	void lateLoad(NodeID dest, NodeID ptr)
+	{
+		addLoad(dest, ptr);
+		if (isExactAddress(ptr))
+			return;
+		const PtsSet &seen = pool.get(propagated[find(ptr)]);
+		if (seen.test(unknownObj))
+			bindUnknownLoads();
+		for (NodeID obj : seen)
+		{
+			if (demandDriven)
+				activate(obj);
+			addCopyEdge(obj, dest);
+		}
+	}
+
+	void lateStore(NodeID ptr, NodeID srcVal)
+	{
+		addStore(ptr, srcVal);
+		if (!isExactAddress(ptr))
+			for (NodeID obj : pool.get(propagated[find(ptr)]))
+				storeInto(obj, srcVal);
+	}
+
+	void lateGep(NodeID dest, NodeID src, int64_t offset)
+	{
+		addGep(dest, src, offset);
+		if (!isExactAddress(src))
+			for (NodeID obj : pool.get(propagated[find(src)]))
+				addFieldPtr(obj, offset, dest);
+	}
+
+	void storeInto(NodeID obj, NodeID srcVal)
+	{
+		if (!holdsPointers.test(obj))
+			return;
+		if (obj == unknownObj)
+		{
+			bindUnknownStores();
+			obj = unknownStore;
+		}
+		if (directObjs[srcVal] != NoObj)
+			addPtrObj(directObjs[srcVal], obj);
+		if (!isExactAddress(srcVal))
+			addCopyEdge(srcVal, obj);
+	}
+
+	void pCopy(NodeID node, PtsID delta)
+	{
+		SmallVector<NodeID, 8> dests;
+		for (NodeID dest : copySuccs[node])
+			dests.push_back(dest);
+		for (NodeID dest : dests)
+		{
+			dest = find(dest);
+			if (dest == node)
+				continue;
+			if (unionInto(dest, delta))
+				enqueue(dest);
+			// Equal sets across an edge are the hint that it may close a cycle.
+			if (pointsTo[dest] == pointsTo[node] && checkedEdges.insert({node, dest}).second)
+				detectCycles(dest);
+			node = find(node);
+		}
+	}
+
+	// x = *node: every new target of node feeds its contents into x.
+	void pLoad(NodeID node, PtsID delta)
+	{
+		if (loadsFrom[node].empty())
+			return;
+		if (demandDriven)
+			for (NodeID obj : pool.get(delta))
+				activate(obj);
+		if (pool.get(delta).test(unknownObj))
+			bindUnknownLoads();
+		for (NodeID obj : pool.get(delta))
+			for (NodeID dest : loadsFrom[node])
+				addCopyEdge(obj, dest);
+	}
+
+	// *node = y: every new target of node receives the targets of y. With
+	// demand, objects nobody asked about yet are left for wire().
+	void pStore(NodeID node, PtsID delta)
+	{
+		for (NodeID obj : pool.get(delta))
+		{
+			if (demandDriven && obj != unknownObj && !active.test(obj))
+				continue;
+			for (NodeID srcVal : storesTo[node])
+			{
+				if (demandDriven)
+					activate(srcVal);
+				storeInto(obj, srcVal);
+			}
+		}
+	}
+
+	// x = gep node, offset: every new target of node gives x the field at that
+	// offset.
+	void pGep(NodeID node, PtsID delta)
+	{
+		for (NodeID obj : pool.get(delta))
+			for (auto [dest, offset] : gepsFrom[node])
+				addFieldPtr(obj, offset, dest);
+	}
+
+	// node(...): every new target of node is a callee of the calls through
+	// it. Targets that are not functions cannot be called and are skipped.
+	void pCall(NodeID node, PtsID delta)
+	{
+		for (unsigned site : callsFrom[node])
+			for (NodeID obj : pool.get(delta))
+				bindCall(site, obj);
+	}
+
+	// Passes the actuals of an indirect call to the formals of callee obj
+	// and its returned pointers to the call, as collectCallEdges() does for
+	// direct calls. Declarations are not looked up in the summaries: unless
+	// they are known to leave pointers alone, and through the unknown object,
+	// the call is as opaque as a call to an unknown function.
+	void bindCall(unsigned site, NodeID obj)
+	{
+		const Function *callee = dyn_cast_or_null<Function>(nodeValues[obj]);
+		if ((!callee && obj != unknownObj) || !boundCalls.insert({site, obj}).second)
+			return;
+		++NumCallTargets;
+		const CallInst &call = *indirectCalls[site].call;
+		if (!callee || callee->isDeclaration())
+		{
+			const CallSummary *summary = findSummary(callee);
+			if (!summary || summary->ret != CallSummary::RetNone || !summary->copies.empty())
+				bindOpaqueCall(site);
+			return;
+		}
+
+		// Every node used here was numbered by collectIndirectCall() and
+		// collectCallees().
+		unsigned numParams = std::min<unsigned>(call.arg_size(), callee->arg_size());
+		for (unsigned i = 0; i < numParams; ++i)
+		{
+			const Argument *formal = callee->getArg(i);
+			if (formal->getType()->isPointerTy() && call.getArgOperand(i)->getType()->isPointerTy())
+				addCallConstraint({ConstraintKind::Copy, nodeIDs.lookup(formal), nodeIDs.lookup(call.getArgOperand(i)), 0});
+		}
+		if (!call.getType()->isPointerTy())
+			return;
+		for (const BasicBlock &basicBlk : *callee)
+			if (auto *ret = dyn_cast<ReturnInst>(basicBlk.getTerminator()))
+				if (const Value *retVal = ret->getReturnValue())
+					if (retVal->getType()->isPointerTy())
+						addCallConstraint({ConstraintKind::Copy, nodeIDs.lookup(&call), nodeIDs.lookup(retVal), 0});
+	}
+
+	// What collectConstraints() assumes of a call to an unknown function,
+	// once per call.
+	void bindOpaqueCall(unsigned site)
+	{
+		if (!boundCalls.insert({site, NoObj}).second)
+			return;
+		const CallInst &call = *indirectCalls[site].call;
+		if (call.getType()->isPointerTy())
+		{
+			NodeID result = nodeIDs.lookup(&call);
+			unknown.push_back(result);
+			addPtrObj(unknownObj, result);
+		}
+		SmallVector<NodeID, 8> ptrargs;
+		for (const auto &arg : call.args())
+			if (arg->getType()->isPointerTy())
+				ptrargs.push_back(nodeIDs.lookup(arg.get()));
+		for (NodeID a1 : ptrargs)
+			for (NodeID a2 : ptrargs)
+				addCallConstraint({ConstraintKind::Store, a1, a2, 0});
+	}
+
+	// Records a constraint of a bound call and pushes what it implies. The
+	// demand-driven indexes are sorted, so its constraints stay out of them;
+	// what they read is wired right away instead.
+	void addCallConstraint(const NodeConstraint &c)
+	{
+		callConstraints.push_back(c);
+		if (demandDriven)
+		{
+			if (!isExactAddress(c.src))
+				activate(c.src);
+			if (c.kind == ConstraintKind::Store)
+			{
+				activate(c.dst);
+				indirectStores.add(c.dst, c.src);
+			}
+		}
+		if (c.kind == ConstraintKind::Copy)
+			addCopy(c.dst, c.src);
+		else
+			lateStore(c.dst, c.src);
+	}
+
+	// Unification has no deltas to bind calls on, so each call is bound to
+	// the callees in its solved callee set instead. Returns true if that
+	// found any new callee, and the system needs solving again.
+	bool bindSolvedCalls()
+	{
+		size_t numBound = boundCalls.size();
+		for (unsigned site = 0; site < indirectCalls.size(); ++site)
+			for (NodeID obj : pool.get(pointsTo[find(indirectCalls[site].callee)]))
+				bindCall(site, obj);
+		return boundCalls.size() != numBound;
+	}
+
+	// Reading through the unknown object may see the contents of any object.
+	void bindUnknownLoads()
+	{
+		if (unknownLoadsBound)
+			return;
+		unknownLoadsBound = true;
+		for (NodeID obj = 0; obj < numObjects; ++obj)
+		{
+			if (demandDriven)
+				activate(obj);
+			addCopyEdge(obj, unknownObj);
+		}
+	}
+
+	// Writing through the unknown object may reach any pointer-holding object.
+	void bindUnknownStores()
+	{
+		if (unknownStoresBound)
+			return;
+		unknownStoresBound = true;
+		for (NodeID obj = 0; obj < numObjects; ++obj)
+			if (obj != unknownObj && holdsPointers.test(obj))
+				addCopyEdge(unknownStore, obj);
+	}
+
+	// Marks node as needed and wires the constraints writing it, and in turn
+	// those of every node they read. Calls made while wiring just queue.
+	void activate(NodeID node)
+	{
+		node = find(node);
+		if (active.test(node))
+			return;
+		active.set(node);
+		toWire.push_back(node);
+		if (wiring)
+			return;
+		wiring = true;
+		while (!toWire.empty())
+			wire(toWire.pop_back_val());
+		wiring = false;
+	}
+
+	// Adds the edges into node, as initConstraints() would have. Loads and
+	// GEPs replay what their pointer has already propagated; from then on
+	// the worklist handles them.
+	void wire(NodeID node)
+	{
+		auto [copyLo, copyHi] = copy.writing(node);
+		for (size_t i = copyLo; i < copyHi; ++i)
+		{
+			if (!isExactAddress(copy.srcs[i]))
+				activate(copy.srcs[i]);
+			addCopy(node, copy.srcs[i]);
+		}
+
+		auto [loadLo, loadHi] = load.writing(node);
+		for (size_t i = loadLo; i < loadHi; ++i)
+		{
+			NodeID ptr = load.srcs[i];
+			if (directObjs[ptr] != NoObj)
+				activate(directObjs[ptr]);
+			if (!isExactAddress(ptr))
+				activate(ptr);
+			lateLoad(node, ptr);
+		}
+
+		auto byDest = [](const FieldEdge &gep, NodeID dest) { return gep.dest < dest; };
+		for (auto it = std::lower_bound(geps.begin(), geps.end(), node, byDest); it != geps.end() && it->dest == node; ++it)
+		{
+			if (!isExactAddress(it->src))
+				activate(it->src);
+			lateGep(node, it->src, it->offset);
+		}
+
+		if (node >= numObjects || !holdsPointers.test(node))
+			return;
+		auto [storeLo, storeHi] = directStores.writing(node);
+		for (size_t i = storeLo; i < storeHi; ++i)
+		{
+			activate(directStores.srcs[i]);
+			storeInto(node, directStores.srcs[i]);
+		}
+		// Any store pointer may reach the object, so all of them are solved
+		// once the first object is needed.
+		if (!storePtrsActive)
+		{
+			storePtrsActive = true;
+			for (NodeID ptr : indirectStores.dsts)
+				activate(ptr);
+		}
+		for (size_t i = 0; i < indirectStores.size(); ++i)
+			if (pool.get(propagated[find(indirectStores.dsts[i])]).test(node))
+			{
+				activate(indirectStores.srcs[i]);
+				storeInto(node, indirectStores.srcs[i]);
+			}
+	}
+
+	// Brings node's set up to date; nothing to do unless solving on demand.
+	void solveFor(NodeID node)
+	{
+		if (!demandDriven)
+			return;
+		activate(node);
+		drain();
+	}
+
+	// Records a constraint added after solving and pushes what it implies.
+	void addLateConstraint(const NodeConstraint &c)
+	{
+		switch (c.kind)
+		{
+		case ConstraintKind::AddressOf:
+			addr.add(c.dst, c.src);
+			addPtrObj(directObjs[c.src], c.dst);
+			break;
+		case ConstraintKind::Copy:
+			copy.add(c.dst, c.src);
+			addCopy(c.dst, c.src);
+			break;
+		case ConstraintKind::Load:
+			load.add(c.dst, c.src);
+			lateLoad(c.dst, c.src);
+			break;
+		case ConstraintKind::Store:
+			store.add(c.dst, c.src);
+			lateStore(c.dst, c.src);
+			break;
+		case ConstraintKind::Gep:
+			geps.push_back({c.dst, c.src, c.offset});
+			lateGep(c.dst, c.src, c.offset);
+			break;
+		}
+	}
+
+	// Sets only grow during propagation, so removing constraints cannot be
+	// done by pushing deltas. Instead everything that may have received
+	// targets through them is cleared: the nodes reachable from what they
+	// wrote, along copy edges and through loads, stores and GEPs, with any
+	// copy cycle among them split up again. The cleared part is then wired
+	// up again from the remaining constraints, with the edges coming in
+	// from the rest of the graph replayed, and solved again.
+	void removeConstraints(ArrayRef<NodeConstraint> removed)
+	{
+		SmallVector<NodeID, 16> pending;
+		for (const NodeConstraint &c : removed)
+		{
+			switch (c.kind)
+			{
+			case ConstraintKind::AddressOf:
+				addr.remove(c.dst, c.src);
+				break;
+			case ConstraintKind::Copy:
+				copy.remove(c.dst, c.src);
+				break;
+			case ConstraintKind::Load:
+				load.remove(c.dst, c.src);
+				break;
+			case ConstraintKind::Store:
+				store.remove(c.dst, c.src);
+				break;
+			case ConstraintKind::Gep:
+			{
+				auto it = llvm::find_if(geps, [&](const FieldEdge &gep) { return gep.dest == c.dst && gep.src == c.src && gep.offset == c.offset; });
+				if (it != geps.end())
+					geps.erase(it);
+				break;
+			}
+			}
+			if (c.kind != ConstraintKind::Store)
+			{
+				pending.push_back(c.dst);
+				continue;
+			}
+			for (NodeID obj : nodePointees(c.dst))
+				pending.push_back(obj == unknownObj ? unknownStore : obj);
+		}
+
+		unsigned numNodes = nodeValues.size();
+		BitVector reached(numNodes);
+		while (!pending.empty())
+		{
+			NodeID node = find(pending.pop_back_val());
+			if (reached.test(node))
+				continue;
+			reached.set(node);
+			for (NodeID dest : copySuccs[node])
+				pending.push_back(dest);
+			pending.append(loadsFrom[node].begin(), loadsFrom[node].end());
+			for (auto [dest, offset] : gepsFrom[node])
+				pending.push_back(dest);
+			if (!storesTo[node].empty())
+				for (NodeID obj : pool.get(pointsTo[node]))
+					pending.push_back(obj == unknownObj ? unknownStore : obj);
+		}
+
+		BitVector cleared(numNodes);
+		PtsSet clearedSet;
+		for (NodeID node = 0; node < numNodes; ++node)
+			if (reached.test(find(node)))
+			{
+				cleared.set(node);
+				clearedSet.set(node);
+			}
+		for (NodeID node = 0; node < numNodes; ++node)
+		{
+			if (cleared.test(node))
+			{
+				rep[node] = node < offlineRep.size() ? offlineRep[node] : node;
+				pointsTo[node] = propagated[node] = PtsSetPool::EmptySet;
+				copySuccs[node].clear();
+				loadsFrom[node].clear();
+				storesTo[node].clear();
+				gepsFrom[node].clear();
+				callsFrom[node].clear();
+				continue;
+			}
+			copySuccs[node].intersectWithComplement(clearedSet);
+			llvm::erase_if(loadsFrom[node], [&](NodeID dest) { return cleared.test(dest); });
+			llvm::erase_if(storesTo[node], [&](NodeID srcVal) { return cleared.test(srcVal); });
+			llvm::erase_if(gepsFrom[node], [&](const std::pair<NodeID, int64_t> &edge) { return cleared.test(edge.first); });
+		}
+		checkedEdges.clear();
+
+		initSeeds();
+		for (size_t i = 0; i < copy.size(); ++i)
+			if (cleared.test(copy.dsts[i]))
+				addCopy(copy.dsts[i], copy.srcs[i]);
+		for (size_t i = 0; i < load.size(); ++i)
+			if (cleared.test(load.dsts[i]))
+				lateLoad(load.dsts[i], load.srcs[i]);
+		for (const FieldEdge &gep : geps)
+			if (cleared.test(gep.dest))
+				lateGep(gep.dest, gep.src, gep.offset);
+
+		auto writesCleared = [&](NodeID obj) { return cleared.test(obj == unknownObj ? unknownStore : obj); };
+		auto replayStore = [&](NodeID ptr, NodeID srcVal)
+		{
+			if (cleared.test(ptr) || cleared.test(srcVal))
+			{
+				lateStore(ptr, srcVal);
+				return;
+			}
+			// Only what the store writes into the cleared part is redone.
+			for (NodeID obj : nodePointees(ptr))
+				if (writesCleared(obj))
+					storeInto(obj, srcVal);
+		};
+		for (size_t i = 0; i < store.size(); ++i)
+			replayStore(store.dsts[i], store.srcs[i]);
+
+		for (unsigned site = 0; site < indirectCalls.size(); ++site)
+			if (cleared.test(indirectCalls[site].callee))
+				callsFrom[find(indirectCalls[site].callee)].push_back(site);
+		for (const NodeConstraint &c : callConstraints)
+		{
+			if (c.kind == ConstraintKind::Store)
+				replayStore(c.dst, c.src);
+			else if (cleared.test(c.dst))
+				addCopy(c.dst, c.src);
+		}
+
+		for (NodeID obj = 0; obj < numObjects; ++obj)
+		{
+			if (unknownLoadsBound && (cleared.test(obj) || cleared.test(unknownObj)))
+				addCopyEdge(obj, unknownObj);
+			if (unknownStoresBound && obj != unknownObj && holdsPointers.test(obj) && (cleared.test(obj) || cleared.test(unknownStore)))
+				addCopyEdge(unknownStore, obj);
+		}
+	}
+
+	// Tarjan's SCC search over copy edges from each root in turn. Components
+	// are handed to onSCC in reverse topological order; nothing is merged
+	// during the search, as merging rewrites the edges being walked.
+	void visitSCCs(ArrayRef<NodeID> roots, function_ref<void(ArrayRef<NodeID>)> onSCC)
+	{
+		struct Frame
+		{
+			NodeID node;
+			SmallVector<NodeID, 4> succs;
+			unsigned next = 0;
+		};
+		llvm::DenseMap<NodeID, unsigned> index, lowLink;
+		SmallVector<NodeID, 16> stack;
+		llvm::DenseSet<NodeID> onStack;
+		SmallVector<Frame, 16> frames;
+
+		auto push = [&](NodeID node)
+		{
+			unsigned idx = index.size();
+			index[node] = lowLink[node] = idx;
+			stack.push_back(node);
+			onStack.insert(node);
+			Frame frame{node, {}};
+			for (NodeID succ : copySuccs[node])
+				frame.succs.push_back(find(succ));
+			frames.push_back(std::move(frame));
+		};
+
+		for (NodeID root : roots)
+		{
+			if (index.count(root))
+				continue;
+			push(root);
+			while (!frames.empty())
+			{
+				Frame &frame = frames.back();
+				if (frame.next < frame.succs.size())
+				{
+					NodeID succ = frame.succs[frame.next++];
+					if (!index.count(succ))
+						push(succ);
+					else if (onStack.count(succ))
+						lowLink[frame.node] = std::min(lowLink[frame.node], index[succ]);
+					continue;
+				}
+
+				NodeID node = frame.node;
+				frames.pop_back();
+				if (!frames.empty())
+					lowLink[frames.back().node] = std::min(lowLink[frames.back().node], lowLink[node]);
+				if (lowLink[node] != index[node])
+					continue;
+
+				SmallVector<NodeID, 4> scc;
+				NodeID member;
+				do
+				{
+					member = stack.pop_back_val();
+					onStack.erase(member);
+					scc.push_back(member);
+				} while (member != node);
+				onSCC(scc);
+			}
+		}
+	}
+
+	// Lazy cycle detection from root: every non-trivial component found is
+	// merged into one node.
+	void detectCycles(NodeID root)
+	{
+		SmallVector<SmallVector<NodeID, 4>, 4> sccs;
+		visitSCCs(find(root), [&](ArrayRef<NodeID> scc)
+		{
+			if (scc.size() > 1)
+				sccs.emplace_back(scc.begin(), scc.end());
+		});
+
+		for (auto &scc : sccs)
+			for (NodeID member : scc)
+				if (member != scc.front())
+					merge(scc.front(), member);
+	}
+
+	// Folds `from` into `into`. Edges of `from` only ever saw what `from`
+	// propagated, so the merged node keeps the intersection as already
+	// propagated and pushes the rest on its next visit.
+	void merge(NodeID into, NodeID from)
+	{
+		into = find(into);
+		from = find(from);
+		if (into == from)
+			return;
+		rep[from] = into;
+		++stats.merged;
+		++NumMerged;
+
+		unionInto(into, pointsTo[from]);
+		pointsTo[from] = PtsSetPool::EmptySet;
+		propagated[into] = pool.intersectionOf(propagated[into], propagated[from]);
+		propagated[from] = PtsSetPool::EmptySet;
+		copySuccs[into] |= copySuccs[from];
+		copySuccs[from].clear();
+
+		for (auto *index : {&loadsFrom, &storesTo})
+		{
+			auto &fromList = (*index)[from];
+			(*index)[into].append(fromList.begin(), fromList.end());
+			fromList.clear();
+		}
+		gepsFrom[into].append(gepsFrom[from].begin(), gepsFrom[from].end());
+		gepsFrom[from].clear();
+		callsFrom[into].append(callsFrom[from].begin(), callsFrom[from].end());
+		callsFrom[from].clear();
+
+		enqueue(into);
+	}
+
+	// Offline variable substitution (Hardekopf and Lin's HU). Nodes whose
+	// targets only come from address-of and copy constraints are labelled
+	// with the address labels and "indirect" nodes (objects, load results,
+	// anything seeded elsewhere) that reach them. Nodes with equal labels end
+	// up with equal points-to sets, so each such class is merged into one node
+	// before solving. Constraints through a node with an empty label never
+	// fire and are dropped, as are the duplicates the merging creates.
+	void substituteVariables()
+	{
+		unsigned numNodes = nodeValues.size();
+		BitVector indirect(numNodes);
+		for (NodeID node = 0; node < numNodes; ++node)
+			if (node < numObjects || !nodeValues[node] || directObjs[node] != NoObj || isa<Constant>(nodeValues[node]))
+				indirect.set(node);
+		for (NodeID dest : load.dsts)
+			indirect.set(dest);
+		for (const FieldEdge &gep : geps)
+			indirect.set(gep.dest);
+		// Binding indirect calls while solving writes these.
+		for (const IndirectCall &site : indirectCalls)
+			if (site.call->getType()->isPointerTy())
+				indirect.set(nodeIDs.lookup(site.call));
+		for (NodeID obj = 0; obj < numObjects; ++obj)
+			if (auto *callee = dyn_cast_or_null<Function>(nodeValues[obj]))
+				for (const Argument &formal : callee->args())
+					if (formal.getType()->isPointerTy())
+						indirect.set(nodeIDs.lookup(&formal));
+
+		// Address labels are object IDs; indirect node n has label numNodes + n.
+		PtsSetPool labelPool;
+		std::vector<PtsID> labels(numNodes, PtsSetPool::EmptySet);
+		std::vector<SmallVector<NodeID, 2>> succs(numNodes);
+		for (NodeID node : indirect.set_bits())
+			labels[node] = labelPool.insert(PtsSetPool::EmptySet, numNodes + node);
+		auto addLabel = [&](NodeID node, NodeID label)
+		{
+			if (!indirect.test(node))
+				labels[node] = labelPool.insert(labels[node], label);
+		};
+		for (size_t i = 0; i < addr.size(); ++i)
+			addLabel(addr.dsts[i], directObjs[addr.srcs[i]]);
+		for (NodeID node : unknown)
+			addLabel(node, unknownObj);
+		for (size_t i = 0; i < copy.size(); ++i)
+		{
+			NodeID srcNode = copy.srcs[i], destNode = copy.dsts[i];
+			if (directObjs[srcNode] != NoObj)
+				addLabel(destNode, directObjs[srcNode]);
+			if (!isExactAddress(srcNode) && !indirect.test(destNode))
+				succs[srcNode].push_back(destNode);
+		}
+
+		SmallVector<NodeID, 64> pending;
+		for (NodeID node = 0; node < numNodes; ++node)
+			if (labels[node] != PtsSetPool::EmptySet)
+				pending.push_back(node);
+		while (!pending.empty())
+		{
+			NodeID node = pending.pop_back_val();
+			for (NodeID succ : succs[node])
+			{
+				PtsID merged = labelPool.unionOf(labels[succ], labels[node]);
+				if (merged != labels[succ])
+				{
+					labels[succ] = merged;
+					pending.push_back(succ);
+				}
+			}
+		}
+
+		llvm::DenseMap<PtsID, NodeID> classRep;
+		for (NodeID node = 0; node < numNodes; ++node)
+		{
+			if (indirect.test(node) || labels[node] == PtsSetPool::EmptySet)
+				continue;
+			auto [it, inserted] = classRep.try_emplace(labels[node], node);
+			if (!inserted)
+				rep[node] = it->second;
+		}
+
+		// What a node contributes when used as a pointer, mirroring the
+		// direct-object handling in initConstraints().
+		auto pointsNowhere = [&](NodeID node)
+		{
+			return directObjs[node] == NoObj && (isExactAddress(node) || labels[node] == PtsSetPool::EmptySet);
+		};
+		auto rewrite = [&](ConstraintList &list, ConstraintKind kind, auto keep)
+		{
+			size_t out = 0;
+			for (size_t i = 0; i < list.size(); ++i)
+			{
+				if (!keep(list.dsts[i], list.srcs[i]))
+				{
+					dropped.push_back({kind, list.dsts[i], list.srcs[i], 0});
+					continue;
+				}
+				list.dsts[out] = find(list.dsts[i]);
+				list.srcs[out] = find(list.srcs[i]);
+				++out;
+			}
+			list.dsts.resize(out);
+			list.srcs.resize(out);
+			list.normalize();
+		};
+		rewrite(addr, ConstraintKind::AddressOf, [](NodeID, NodeID) { return true; });
+		rewrite(copy, ConstraintKind::Copy, [&](NodeID dest, NodeID src) { return !pointsNowhere(src) && find(dest) != find(src); });
+		rewrite(load, ConstraintKind::Load, [&](NodeID, NodeID ptr) { return !pointsNowhere(ptr); });
+		rewrite(store, ConstraintKind::Store, [&](NodeID ptr, NodeID val) { return !pointsNowhere(ptr) && !pointsNowhere(val); });
+
+		for (NodeID &node : unknown)
+			node = find(node);
+		llvm::sort(unknown);
+		unknown.erase(std::unique(unknown.begin(), unknown.end()), unknown.end());
+
+		auto out = geps.begin();
+		for (FieldEdge &gep : geps)
+		{
+			if (!pointsNowhere(gep.src))
+				*out++ = {gep.dest, find(gep.src), gep.offset};
+			else
+				dropped.push_back({ConstraintKind::Gep, gep.dest, gep.src, gep.offset});
+		}
+		geps.erase(out, geps.end());
+
+		offlineRep = rep;
+		offlineMerged.resize(numNodes);
+		for (NodeID node = 0; node < numNodes; ++node)
+			if (rep[node] != node)
+			{
+				offlineMerged.set(node);
+				offlineMerged.set(rep[node]);
+			}
+	}
+
+	// Partial SSA. Pointer registers are in SSA form, and one only defined
+	// by copies (a phi, select, cast, or the formal of a function that is
+	// only called directly) ends up with exactly the union of what it
+	// copies from. Such registers are resolved here along their def-use
+	// chains, down to the objects they get directly and the nodes left in
+	// the graph they copy from, and leave the graph: the add* functions
+	// rewire constraints through them to those, and resolveRegisters() gives
+	// them their sets once solving is done. What remains for the fixpoint
+	// is memory objects and the registers memory feeds. Registers reading
+	// from too many nodes stay, as rewiring their uses would add more edges
+	// than it saves.
+	void splitTopLevel()
+	{
+		static constexpr unsigned MaxSources = 16;
+		unsigned numNodes = nodeValues.size();
+		BitVector kept(numNodes);
+		for (NodeID node = 0; node < numNodes; ++node)
+			if (node < numObjects || find(node) != node || !isa_and_nonnull<Instruction, Argument>(nodeValues[node]))
+				kept.set(node);
+		// Written by loads, GEPs or calls bound while solving, or stored.
+		for (NodeID dest : load.dsts)
+			kept.set(find(dest));
+		for (const FieldEdge &gep : geps)
+			kept.set(find(gep.dest));
+		for (NodeID srcVal : store.srcs)
+			kept.set(find(srcVal));
+		for (const IndirectCall &site : indirectCalls)
+		{
+			kept.set(find(site.callee));
+			for (const auto &arg : site.call->args())
+				if (arg->getType()->isPointerTy())
+					kept.set(find(nodeIDs.lookup(arg.get())));
+			if (site.call->getType()->isPointerTy())
+				kept.set(find(nodeIDs.lookup(site.call)));
+		}
+		for (NodeID obj = 0; obj < numObjects; ++obj)
+			if (auto *callee = dyn_cast_or_null<Function>(nodeValues[obj]))
+			{
+				for (const Argument &formal : callee->args())
+					if (formal.getType()->isPointerTy())
+						kept.set(find(nodeIDs.lookup(&formal)));
+				for (const BasicBlock &basicBlk : *callee)
+					if (auto *ret = dyn_cast<ReturnInst>(basicBlk.getTerminator()))
+						if (const Value *retVal = ret->getReturnValue())
+							kept.set(find(nodeIDs.lookup(retVal)));
+			}
+
+		PtsSetPool sourcePool;
+		std::vector<PtsID> objects, sources;
+		while (true)
+		{
+			objects.assign(numNodes, PtsSetPool::EmptySet);
+			sources.assign(numNodes, PtsSetPool::EmptySet);
+			std::vector<SmallVector<NodeID, 2>> succs(numNodes);
+			for (size_t i = 0; i < addr.size(); ++i)
+				if (!kept.test(addr.dsts[i]))
+					objects[addr.dsts[i]] = pool.insert(objects[addr.dsts[i]], directObjs[addr.srcs[i]]);
+			for (NodeID node : unknown)
+				if (!kept.test(node))
+					objects[node] = pool.insert(objects[node], unknownObj);
+			// Mirrors addCopy().
+			for (size_t i = 0; i < copy.size(); ++i)
+			{
+				NodeID dest = copy.dsts[i], src = copy.srcs[i];
+				if (kept.test(dest))
+					continue;
+				if (directObjs[src] != NoObj)
+					objects[dest] = pool.insert(objects[dest], directObjs[src]);
+				if (!kept.test(src))
+					succs[src].push_back(dest);
+				else if (!isExactAddress(src))
+					sources[dest] = sourcePool.insert(sources[dest], src);
+			}
+
+			SmallVector<NodeID, 64> pending;
+			for (NodeID node = 0; node < numNodes; ++node)
+				if (!kept.test(node))
+					pending.push_back(node);
+			while (!pending.empty())
+			{
+				NodeID node = pending.pop_back_val();
+				for (NodeID succ : succs[node])
+				{
+					PtsID grownObjects = pool.unionOf(objects[succ], objects[node]);
+					PtsID grownSources = sourcePool.unionOf(sources[succ], sources[node]);
+					if (grownObjects == objects[succ] && grownSources == sources[succ])
+						continue;
+					objects[succ] = grownObjects;
+					sources[succ] = grownSources;
+					pending.push_back(succ);
+				}
+			}
+
+			bool split = true;
+			for (NodeID node = 0; node < numNodes; ++node)
+				if (!kept.test(node) && sourcePool.get(sources[node]).count() > MaxSources)
+				{
+					kept.set(node);
+					split = false;
+				}
+			if (split)
+				break;
+		}
+
+		for (NodeID node = 0; node < numNodes; ++node)
+		{
+			if (kept.test(node))
+				continue;
+			Register &reg = registers[node];
+			reg.objects = objects[node];
+			for (NodeID src : sourcePool.get(sources[node]))
+				reg.sources.push_back(src);
+			++NumRegistersSplit;
+		}
+	}
+
+	// What a register taken out by splitTopLevel() points to directly when
+	// used as a pointer operand.
+	PtsSet registerTargets(NodeID reg)
+	{
+		PtsSet targets = pool.get(registers.lookup(reg).objects);
+		if (directObjs[reg] != NoObj)
+			targets.set(directObjs[reg]);
+		return targets;
+	}
+
+	void resolveRegisters()
+	{
+		for (auto &[node, reg] : registers)
+		{
+			PtsID set = reg.objects;
+			for (NodeID src : reg.sources)
+				set = pool.unionOf(set, pointsTo[find(src)]);
+			pointsTo[node] = propagated[node] = set;
+		}
+	}
+
+	// Wave propagation (Pereira and Berlin): collapse every copy cycle, then
+	// push sets through the now acyclic copy graph in topological order, then
+	// resolve loads, stores and GEPs against what changed, and repeat until
+	// that adds nothing. Nodes on the same topological level have no edges
+	// between them, so each level pulls from its predecessors in parallel.
+	// The set pool is not thread-safe: workers only read it and the new sets
+	// are interned once the level is done. Workers come from a pool of our
+	// own, so -pta-threads leaves the rest of the process alone.
+	void solveByWaves()
+	{
+		DefaultThreadPool threads(hardware_concurrency(SolverThreads));
+		// Runs body(i) for every i in [0, size), in chunks spread over the
+		// workers, and waits for all of them.
+		auto parallelRange = [&](size_t size, function_ref<void(size_t)> body)
+		{
+			size_t chunk = std::max<size_t>(64, size / (4 * threads.getMaxConcurrency()));
+			if (size <= chunk)
+			{
+				for (size_t i = 0; i < size; ++i)
+					body(i);
+				return;
+			}
+			for (size_t begin = 0; begin < size; begin += chunk)
+				threads.async([=]
+				{
+					for (size_t i = begin; i < std::min(begin + chunk, size); ++i)
+						body(i);
+				});
+			threads.wait();
+		};
+		worklist.clear();
+		inWorklist.reset();
+
+		while (true)
+		{
+			if (overBudget())
+			{
+				degrade();
+				return;
+			}
+			++stats.rounds;
+			++NumRounds;
+			SmallVector<NodeID, 64> roots;
+			for (NodeID node = 0; node < nodeValues.size(); ++node)
+				if (find(node) == node)
+					roots.push_back(node);
+			SmallVector<SmallVector<NodeID, 4>, 64> sccs;
+			visitSCCs(roots, [&](ArrayRef<NodeID> scc) { sccs.emplace_back(scc.begin(), scc.end()); });
+			std::vector<NodeID> order;
+			for (auto &scc : llvm::reverse(sccs))
+			{
+				for (NodeID member : scc)
+					if (member != scc.front())
+						merge(scc.front(), member);
+				order.push_back(find(scc.front()));
+			}
+
+			// Longest-path levels; every edge goes from a lower level to a higher one.
+			llvm::DenseMap<NodeID, unsigned> level;
+			llvm::DenseMap<NodeID, SmallVector<NodeID, 2>> preds;
+			std::vector<std::vector<NodeID>> levels;
+			for (NodeID node : order)
+			{
+				unsigned lvl = level.lookup(node);
+				if (levels.size() <= lvl)
+					levels.resize(lvl + 1);
+				levels[lvl].push_back(node);
+				for (NodeID succ : copySuccs[node])
+				{
+					succ = find(succ);
+					if (succ == node)
+						continue;
+					preds[succ].push_back(node);
+					unsigned &succLevel = level[succ];
+					succLevel = std::max(succLevel, lvl + 1);
+				}
+			}
+
+			uint64_t copyEdges = 0;
+			for (const auto &entry : preds)
+				copyEdges += entry.second.size();
+			measure(ConstraintKind::Copy, copyEdges, 0, [&]
+			{
+				for (const std::vector<NodeID> &nodes : levels)
+				{
+					std::vector<std::optional<PtsSet>> grown(nodes.size());
+					std::vector<std::vector<uint64_t>> grownWords(nodes.size());
+					for (NodeID node : nodes)
+					{
+						auto it = preds.find(node);
+						if (it == preds.end())
+							continue;
+						pool.makeDense(pointsTo[node]);
+						for (NodeID pred : it->second)
+							pool.makeDense(pointsTo[pred]);
+					}
+					parallelRange(nodes.size(), [&](size_t i)
+					{
+						auto it = preds.find(nodes[i]);
+						if (it == preds.end())
+							return;
+						const PtsSet &current = pool.get(pointsTo[nodes[i]]);
+						// Large sets are compared and merged word-wise; the
+						// sparse set is only grown by the preds that add to it.
+						const std::vector<uint64_t> *dense = pool.denseOf(pointsTo[nodes[i]]);
+						if (dense && llvm::all_of(it->second, [&](NodeID pred) { return pool.denseOf(pointsTo[pred]); }))
+						{
+							std::vector<uint64_t> words = *dense;
+							for (NodeID pred : it->second)
+							{
+								const std::vector<uint64_t> &incoming = *pool.denseOf(pointsTo[pred]);
+								if (words.size() < incoming.size())
+									words.resize(incoming.size());
+								if (!unionWords(words.data(), incoming.data(), incoming.size()))
+									continue;
+								if (!grown[i])
+									grown[i] = current;
+								*grown[i] |= pool.get(pointsTo[pred]);
+							}
+							if (grown[i])
+								grownWords[i] = std::move(words);
+							return;
+						}
+						for (NodeID pred : it->second)
+						{
+							const PtsSet &incoming = pool.get(pointsTo[pred]);
+							if (grown[i] ? grown[i]->contains(incoming) : current.contains(incoming))
+								continue;
+							if (!grown[i])
+								grown[i] = current;
+							*grown[i] |= incoming;
+						}
+					});
+					for (size_t i = 0; i < nodes.size(); ++i)
+						if (grown[i] && !grownWords[i].empty())
+							pointsTo[nodes[i]] = pool.intern(std::move(*grown[i]), std::move(grownWords[i]));
+						else if (grown[i])
+							pointsTo[nodes[i]] = pool.intern(std::move(*grown[i]));
+				}
+			});
+
+			// Complex constraints see each node's growth since the last wave; any
+			// new edge or target means another wave.
+			graphGrew = false;
+			for (NodeID node : order)
+			{
+				if (find(node) != node)
+					continue;
+				PtsID delta = pool.differenceOf(pointsTo[node], propagated[node]);
+				if (delta == PtsSetPool::EmptySet)
+					continue;
+				propagated[node] = pointsTo[node];
+				propagate(node, delta, false);
+			}
+			worklist.clear();
+			inWorklist.reset();
+			if (!graphGrew)
+				break;
+		}
+	}
+
+	size_t numConstraints() const
+	{
+		return addr.size() + copy.size() + load.size() + store.size() + transfer.size() + geps.size() + unknown.size();
+	}
+
+	// Steensgaard's analysis over the graph initConstraints() built: seeds,
+	// copy, load, store and GEP edges all become joins, so each object set
+	// is one class and results are coarser than Andersen's. Fields of an
+	// object are joined up front, as GEPs are treated as plain copies.
+	void solveByUnification()
+	{
+		unsigned numNodes = nodeValues.size();
+		Unifier uni(numNodes);
+		for (NodeID obj = 0; obj < numObjects; ++obj)
+			if (objFields[obj].base != obj)
+				uni.join(objFields[obj].base, obj);
+
+		for (NodeID node = 0; node < numNodes; ++node)
+		{
+			for (NodeID obj : pool.get(pointsTo[node]))
+				uni.join(uni.pointee(node), obj);
+			for (NodeID dest : copySuccs[node])
+				uni.join(uni.pointee(dest), uni.pointee(node));
+			for (auto [dest, offset] : gepsFrom[node])
+				uni.join(uni.pointee(dest), uni.pointee(node));
+			for (NodeID dest : loadsFrom[node])
+				uni.join(uni.pointee(dest), uni.pointee(uni.pointee(node)));
+			// Mirrors storeInto(): a stored object address is stored as is.
+			for (NodeID srcVal : storesTo[node])
+			{
+				NodeID contents = uni.pointee(uni.pointee(node));
+				if (directObjs[srcVal] != NoObj)
+					uni.join(contents, directObjs[srcVal]);
+				if (!isExactAddress(srcVal))
+					uni.join(contents, uni.pointee(srcVal));
+			}
+		}
+
+		// Going through the unknown object reaches the contents of every object.
+		NodeID unknownClass = uni.find(unknownObj);
+		for (NodeID node = 0; node < numNodes; ++node)
+			if ((!loadsFrom[node].empty() || !storesTo[node].empty()) && uni.hasPointee(node) && uni.pointee(node) == unknownClass)
+			{
+				for (NodeID obj = 0; obj < numObjects; ++obj)
+					uni.join(uni.pointee(obj), uni.pointee(unknownObj));
+				break;
+			}
+
+		llvm::DenseMap<NodeID, PtsSet> members;
+		for (NodeID obj = 0; obj < numObjects; ++obj)
+			members[uni.find(obj)].set(obj);
+		llvm::DenseMap<NodeID, PtsID> classSets;
+		for (NodeID node = 0; node < numNodes; ++node)
+		{
+			if (!uni.hasPointee(node))
+			{
+				pointsTo[node] = PtsSetPool::EmptySet;
+				continue;
+			}
+			NodeID cls = uni.pointee(node);
+			auto [it, inserted] = classSets.try_emplace(cls, PtsSetPool::EmptySet);
+			if (inserted)
+			{
+				auto found = members.find(cls);
+				if (found != members.end())
+					it->second = pool.intern(std::move(found->second));
+			}
+			pointsTo[node] = it->second;
+		}
+		propagated = pointsTo;
+		worklist.clear();
+		inWorklist.reset();
+	}
+
+	void solve()
+	{
+		instrumented = AreStatisticsEnabled() || !StatsFile.empty();
+		stats.constraints = numConstraints();
+		auto start = std::chrono::steady_clock::now();
+		solveSystem();
+		stats.solveSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		++NumSolves;
+		if (stats.cached)
+			++NumCacheHits;
+		if (instrumented)
+			for (NodeID node = 0; node < nodeValues.size(); ++node)
+				MaxSetSize.updateMax(pool.get(pointsTo[find(node)]).count());
+	}
+
+	// Systems above the threshold are unified instead; with demand, only the
+	// seeds are propagated until a query asks for more. Alias queries solve
+	// everything up front, as the passes asking them edit the IR that a
+	// later demand-driven step would read. Only complete results go to the
+	// cache.
+	void solveSystem()
+	{
+		unification = Solver == SolverKind::Steensgaard || (SteensgaardThreshold && numConstraints() > SteensgaardThreshold);
+		demandDriven = DemandDriven && !unification && !openWorld;
+		initNodes();
+		if (loadCache())
+		{
+			stats.cached = true;
+			// The cache keeps sets only, so find the fields that GEPs point
+			// into the middle of again. A field marked late may have GEPs
+			// from it resolved already, hence the fixpoint.
+			BitVector before;
+			do
+			{
+				before = interiorFields;
+				for (const FieldEdge &gep : geps)
+				{
+					if (directObjs[gep.src] != NoObj)
+						resolveField(directObjs[gep.src], gep.offset, getPtrObj(nodeValues[gep.src]));
+					if (!isExactAddress(gep.src))
+						for (NodeID obj : pool.get(pointsTo[find(gep.src)]))
+							resolveField(obj, gep.offset, false);
+				}
+			} while (before != interiorFields);
+			return;
+		}
+		if (VariableSubstitution)
+			substituteVariables();
+		if (demandDriven)
+		{
+			initDemand();
+			drain();
+			return;
+		}
+		if (PartialSSA && !unification)
+			splitTopLevel();
+		initConstraints();
+		if (unification)
+		{
+			solveByUnification();
+			while (bindSolvedCalls())
+				solveByUnification();
+		}
+		else
+		{
+			budgeted = true;
+			if (ParallelSolve)
+				solveByWaves();
+			else
+				drain();
+			budgeted = false;
+		}
+		resolveRegisters();
+		saveCache();
+	}
+
+	bool overBudget() const
+	{
+		return budgeted && ((VisitBudget && visitCount > VisitBudget) || (MemoryBudget && pool.memoryUsage() > (uint64_t(MemoryBudget) << 20)));
+	}
+
+	// Gives up on inclusion and solves the whole system again from its
+	// constraints by unification, whose time and memory stay near-linear.
+	// Offline substitution's merges are kept; everything else the solver
+	// built is dropped, the set pool included, so its memory goes too.
+	void degrade()
+	{
+		errs() << "pointer-analysis: " << (function ? function->getName() : StringRef(M.getModuleIdentifier())) << " is over budget, solving by unification\n";
+		stats.overBudget = true;
+		++NumOverBudget;
+		budgeted = false;
+		unification = true;
+		demandDriven = false;
+
+		pool = PtsSetPool();
+		for (auto *table : {&pointsTo, &propagated, &directObjs, &rep})
+			table->clear();
+		copySuccs.clear();
+		loadsFrom.clear();
+		storesTo.clear();
+		gepsFrom.clear();
+		callsFrom.clear();
+		inWorklist.clear();
+		active.clear();
+		worklist.clear();
+		checkedEdges.clear();
+		registers.clear();
+		boundCalls.clear();
+		callConstraints.clear();
+		directStores = indirectStores = ConstraintList();
+		toWire.clear();
+		storePtrsActive = unknownLoadsBound = unknownStoresBound = false;
+		exposed.reset();
+		growTables();
+		for (NodeID node = 0; node < offlineRep.size(); ++node)
+			rep[node] = offlineRep[node];
+
+		initConstraints();
+		solveByUnification();
+		while (bindSolvedCalls())
+			solveByUnification();
+	}
+
+	// Difference propagation: a node is only revisited when its set grew, and
+	// only the elements added since its last visit travel along its edges.
+	void drain()
+	{
+		if (!worklist.empty())
+		{
+			++stats.rounds;
+			++NumRounds;
+		}
+		while (!worklist.empty())
+		{
+			if (overBudget())
+			{
+				degrade();
+				return;
+			}
+			NodeID node = worklist.pop_back_val();
+			inWorklist.reset(node);
+			if (find(node) != node)
+				continue;
+
+			PtsID delta = pool.differenceOf(pointsTo[node], propagated[node]);
+			if (delta == PtsSetPool::EmptySet)
+				continue;
+			propagated[node] = pointsTo[node];
+			propagate(node, delta, true);
+		}
+	}
+
+	// Pushes node's new targets through its loads, stores and GEPs, and
+	// along its copy edges unless the waves do that.
+	void propagate(NodeID node, PtsID delta, bool copies)
+	{
+		uint64_t targets = 0;
+		++visitCount;
+		if (instrumented)
+		{
+			targets = pool.get(delta).count();
+			++stats.nodeVisits;
+			++NumNodeVisits;
+		}
+		measure(ConstraintKind::Load, loadsFrom[node].size(), targets, [&] { pLoad(node, delta); });
+		measure(ConstraintKind::Store, storesTo[node].size(), targets, [&] { pStore(node, delta); });
+		measure(ConstraintKind::Gep, gepsFrom[node].size(), targets, [&] { pGep(node, delta); });
+		if (!callsFrom[node].empty())
+			pCall(node, delta);
+		if (copies)
+			measure(ConstraintKind::Copy, copySuccs[node].count(), targets, [&] { pCopy(node, delta); });
+	}
+
+	// Runs one kind of constraint over `targets` new targets, counting and
+	// timing it when instrumented.
+	template <typename Fn>
+	void measure(ConstraintKind kind, uint64_t constraints, uint64_t targets, Fn &&run)
+	{
+		if (!instrumented)
+		{
+			run();
+			return;
+		}
+		stats.visits[unsigned(kind)] += constraints;
+		stats.propagated += constraints * targets;
+		NumConstraintVisits += constraints;
+		NumPropagated += constraints * targets;
+		auto start = std::chrono::steady_clock::now();
+		run();
+		stats.seconds[unsigned(kind)] += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	}
+
+	// A set holding the unknown object may point to any memory object.
+	PtsSet expandUnknown(const PtsSet &set)
+	{
+		if (!set.test(unknownObj))
+			return set;
+		PtsSet all;
+		for (NodeID obj = 0; obj < numObjects; ++obj)
+			if (obj != unknownObj)
+				all.set(obj);
+		return all;
+	}
+
+	// What node points to when used as a pointer operand.
+	PtsSet nodePointees(NodeID node)
+	{
+		PtsSet set;
+		if (directObjs[node] != NoObj)
+			set.set(directObjs[node]);
+		if (!isExactAddress(node))
+		{
+			solveFor(node);
+			set |= pool.get(pointsTo[find(node)]);
+		}
+		return set;
+	}
+
+	const PtsSet *lookupPtsToSet(const Value *val)
+	{
+		auto it = nodeIDs.find(val);
+		if (it == nodeIDs.end())
+			return nullptr;
+		solveFor(it->second);
+		return &pool.get(pointsTo[find(it->second)]);
+	}
+
+
+	// Result cache. Node numbering only depends on the IR, so a solved
+	// system is stored as the points-to set of each node, keyed by a hash of
+	// the printed IR it was built from and of every option that changes the
+	// result. A file holds a header, then for each node the index of its
+	// set, then the sets as offsets into one array of objects; the tables
+	// are read in place and each set is interned once. The header also
+	// records whether the system was unified, which changes what an object
+	// used as a pointer operand points to.
+	struct CacheHeader
+	{
+		uint32_t magic, version;
+		uint64_t key;
+		uint32_t numNodes, numObjects, numSets, numElems;
+		uint32_t unified, reserved;
+	};
+	static constexpr uint32_t CacheMagic = 0x31415450; // "PTA1"
+	static constexpr uint32_t CacheVersion = 3;
+	uint64_t cacheKey = 0;
+
+	void hashInputs(const Function *F, uint64_t moduleKey)
+	{
+		std::string text;
+		raw_string_ostream os(text);
+		os << CacheVersion << ' ' << wholeModule << ' ' << openWorld << ' ' << FieldSensitive << ' ' << FieldLimit << ' ' << int(Solver.getValue()) << ' ' << SteensgaardThreshold << ' ' << HeapCloning << ' ' << TypeFilter << '\n';
+		// Whether a system goes over budget depends on how it is solved, so
+		// with a budget the solver's configuration is part of the key too.
+		// Demand-driven runs ignore budgets and read precise results.
+		if ((MemoryBudget || VisitBudget) && !DemandDriven)
+			os << MemoryBudget << ' ' << VisitBudget << ' ' << ParallelSolve << ' ' << PartialSSA << ' ' << VariableSubstitution << '\n';
+		os << utohexstr(moduleKey) << '\n';
+		if (F)
+			os << *F;
+		else
+			for (const Function &fn : M)
+				os << fn;
+		cacheKey = xxHash64(os.str());
+	}
+
+	std::string cachePath() const
+	{
+		SmallString<128> path(CacheDir);
+		sys::path::append(path, utohexstr(cacheKey) + ".pta");
+		return std::string(path);
+	}
+
+	bool loadCache()
+	{
+		if (CacheDir.empty())
+			return false;
+		auto buffer = MemoryBuffer::getFile(cachePath(), /*IsText=*/false, /*RequiresNullTerminator=*/false);
+		if (!buffer)
+			return false;
+		StringRef data = (*buffer)->getBuffer();
+		CacheHeader header;
+		if (data.size() < sizeof(header))
+			return false;
+		memcpy(&header, data.data(), sizeof(header));
+		size_t words = size_t(header.numNodes) + header.numSets + 1 + header.numElems;
+		if (header.magic != CacheMagic || header.version != CacheVersion || header.key != cacheKey || header.numNodes != nodeValues.size() || header.numObjects != numObjects || data.size() != sizeof(header) + words * sizeof(uint32_t))
+			return false;
+
+		// The header keeps the tables after it 4-byte aligned.
+		const char *tables = data.data() + sizeof(header);
+		if (reinterpret_cast<uintptr_t>(tables) % alignof(uint32_t))
+			return false;
+		const uint32_t *setOf = reinterpret_cast<const uint32_t *>(tables), *setStart = setOf + header.numNodes, *elems = setStart + header.numSets + 1;
+		// A corrupt or stale entry is a miss, not an out-of-bounds read.
+		if (setStart[0] != 0 || setStart[header.numSets] != header.numElems)
+			return false;
+		for (uint32_t i = 0; i < header.numSets; ++i)
+			if (setStart[i] > setStart[i + 1])
+				return false;
+		for (uint32_t e = 0; e < header.numElems; ++e)
+			if (elems[e] >= numObjects)
+				return false;
+		for (NodeID node = 0; node < header.numNodes; ++node)
+			if (setOf[node] >= header.numSets)
+				return false;
+		std::vector<PtsID> sets(header.numSets);
+		for (uint32_t i = 0; i < header.numSets; ++i)
+		{
+			PtsSet set;
+			for (uint32_t e = setStart[i]; e < setStart[i + 1]; ++e)
+				set.set(elems[e]);
+			sets[i] = pool.intern(std::move(set));
+		}
+		for (NodeID node = 0; node < header.numNodes; ++node)
+			pointsTo[node] = sets[setOf[node]];
+		propagated = pointsTo;
+		demandDriven = false;
+		unification = header.unified;
+		return true;
+	}
+
+	void saveCache()
+	{
+		if (CacheDir.empty())
+			return;
+		CacheHeader header = {CacheMagic, CacheVersion, cacheKey, unsigned(nodeValues.size()), numObjects, 0, 0, unification, 0};
+		std::vector<uint32_t> setOf(header.numNodes), setStart(1, 0), elems;
+		llvm::DenseMap<PtsID, uint32_t> setIndex;
+		for (NodeID node = 0; node < header.numNodes; ++node)
+		{
+			PtsID set = pointsTo[find(node)];
+			auto [it, inserted] = setIndex.try_emplace(set, setIndex.size());
+			if (inserted)
+			{
+				for (NodeID obj : pool.get(set))
+					elems.push_back(obj);
+				setStart.push_back(elems.size());
+			}
+			setOf[node] = it->second;
+		}
+		header.numSets = setIndex.size();
+		header.numElems = elems.size();
+
+		// Written under a temporary name and renamed, so a concurrent reader
+		// never sees a partial file.
+		std::string path = cachePath();
+		SmallString<128> tempPath;
+		int fd;
+		std::error_code ec = sys::fs::create_directories(CacheDir);
+		if (!ec)
+			ec = sys::fs::createUniqueFile(path + ".%%%%%%", fd, tempPath);
+		if (ec)
+		{
+			errs() << "pointer-analysis: cannot write cache in " << CacheDir << ": " << ec.message() << "\n";
+			return;
+		}
+		{
+			raw_fd_ostream os(fd, /*shouldClose=*/true);
+			os.write(reinterpret_cast<const char *>(&header), sizeof(header));
+			for (const std::vector<uint32_t> *part : {&setOf, &setStart, &elems})
+				os.write(reinterpret_cast<const char *>(part->data()), part->size() * sizeof(uint32_t));
+			os.close();
+			ec = os.error();
+			os.clear_error();
+		}
+		if (!ec)
+			ec = sys::fs::rename(tempPath, path);
+		if (ec)
+		{
+			errs() << "pointer-analysis: cannot write " << path << ": " << ec.message() << "\n";
+			sys::fs::remove(tempPath);
+		}
+	}
+
+	void collectGlobals()
+	{
+		for (auto &gVar : M.globals())
+			addMemObj(&gVar);
+	}
+
+	// Whole-module mode: functions whose address is taken are objects, so
+	// function pointers point to them.
+	void collectFunctions()
+	{
+		for (const Function &F : M)
+			if (F.hasAddressTaken())
+				addMemObj(&F);
+	}
+
+	// Numbers the formals and returned values of the functions an indirect
+	// call may be bound to, for bindCall().
+	void collectCallees()
+	{
+		for (const Function &F : M)
+		{
+			if (!memObj.count(&F))
+				continue;
+			for (const Argument &formal : F.args())
+				if (formal.getType()->isPointerTy())
+					getNode(&formal);
+			for (const BasicBlock &basicBlk : F)
+				if (auto *ret = dyn_cast<ReturnInst>(basicBlk.getTerminator()))
+					if (const Value *retVal = ret->getReturnValue())
+						getNode(retVal);
+		}
+	}
+
+	void collectAllocas(const Function &F)
+	{
+		for (auto &basicBlk : F)
+		{
+			for (auto &inst : basicBlk)
+			{
+				if (auto *A = dyn_cast<AllocaInst>(&inst))
+					addMemObj(A);
+			}
+		}
+	}
+
+	// A call returning fresh memory is the allocation site of a heap object.
+	// The call is that object and also the pointer to it, as an alloca is.
+	bool isAllocCall(const Value *val)
+	{
+		auto *call = dyn_cast<CallInst>(val);
+		if (!call || !call->getType()->isPointerTy())
+			return false;
+		const Function *callee = dyn_cast<Function>(call->getCalledOperand()->stripPointerCasts());
+		if (wholeModule && callee && !callee->isDeclaration())
+			return false;
+		const CallSummary *summary = findSummary(callee);
+		return summary && summary->ret == CallSummary::RetAlloc;
+	}
+
+	// The allocation sites inside an allocation wrapper: a function whose
+	// every return value comes straight from an allocation call, and which
+	// only reads, writes, compares or frees that memory before returning it.
+	// Empty for any other function.
+	const SmallVector<const CallInst *, 1> &wrappedSites(const Function &F)
+	{
+		auto [it, inserted] = wrappers.try_emplace(&F);
+		if (!inserted || F.isDeclaration() || !F.getReturnType()->isPointerTy())
+			return it->second;
+
+		auto staysLocal = [&](const Value *site)
+		{
+			SmallVector<const Value *, 8> pending = {site};
+			while (!pending.empty())
+			{
+				const Value *val = pending.pop_back_val();
+				for (const User *user : val->users())
+				{
+					if (isa<ReturnInst, LoadInst, ICmpInst>(user))
+						continue;
+					if (auto *store = dyn_cast<StoreInst>(user))
+					{
+						if (store->getValueOperand() == val)
+							return false;
+						continue;
+					}
+					if (isa<BitCastInst, GetElementPtrInst>(user))
+					{
+						pending.push_back(user);
+						continue;
+					}
+					auto *call = dyn_cast<CallInst>(user);
+					const CallSummary *summary = call ? findSummary(call->getCalledFunction()) : nullptr;
+					if (!summary || summary->ret != CallSummary::RetNone || !summary->copies.empty())
+						return false;
+				}
+			}
+			return true;
+		};
+
+		SmallVector<const CallInst *, 1> sites;
+		for (const BasicBlock &basicBlk : F)
+			if (auto *ret = dyn_cast<ReturnInst>(basicBlk.getTerminator()))
+			{
+				auto *site = dyn_cast_or_null<CallInst>(ret->getReturnValue() ? ret->getReturnValue()->stripPointerCasts() : nullptr);
+				if (!site || !isAllocCall(site) || !staysLocal(site))
+					return it->second;
+				if (!is_contained(sites, site))
+					sites.push_back(site);
+			}
+		it->second = std::move(sites);
+		return it->second;
+	}
+
+	void collectHeapSites(const Function &F)
+	{
+		for (const BasicBlock &basicBlk : F)
+			for (const Instruction &inst : basicBlk)
+			{
+				if (isAllocCall(&inst))
+				{
+					addMemObj(&inst);
+					continue;
+				}
+				auto *call = dyn_cast<CallInst>(&inst);
+				if (!wholeModule || !HeapCloning || !call || !call->getCalledFunction())
+					continue;
+				if (!wrappedSites(*call->getCalledFunction()).empty())
+					addMemObj(call);
+			}
+	}
+
+	void collectGlobalInits()
+	{
+		for (auto &gVar : M.globals())
+		{
+			if (gVar.hasInitializer())
+			{
+				const Constant *init = gVar.getInitializer();
+				if (const Value *target = getPtrOpd(init))
+				{
+					// With fields, the initializer itself names the field.
+					addConstraint(addr, &gVar, FieldSensitive ? init : target);
+				}
+			}
+		}
+	}
+
+	// Whole-module mode only: binds pointer actuals to the callee's formals and
+	// the callee's returned pointers to the call.
+	void collectCallEdges(const CallInst &call, const Function &callee)
+	{
+		unsigned numParams = std::min<unsigned>(call.arg_size(), callee.arg_size());
+		for (unsigned i = 0; i < numParams; ++i)
+		{
+			const Argument *formal = callee.getArg(i);
+			if (formal->getType()->isPointerTy())
+				addConstraint(copy, formal, call.getArgOperand(i));
+		}
+
+		if (!call.getType()->isPointerTy())
+			return;
+		// A call cloning a wrapper's heap objects starts out with whatever the
+		// wrapper stored into them.
+		if (memObj.count(&call))
+		{
+			for (const CallInst *site : wrappedSites(callee))
+				addConstraint(transfer, &call, site);
+			return;
+		}
+		for (const BasicBlock &basicBlk : callee)
+			if (auto *ret = dyn_cast<ReturnInst>(basicBlk.getTerminator()))
+				if (const Value *retVal = ret->getReturnValue())
+					addConstraint(copy, &call, retVal);
+	}
+
+	// Whole-module mode only: a call through a pointer is bound to its
+	// callees while solving, see pCall(). The nodes that needs are numbered
+	// now.
+	void collectIndirectCall(const CallInst &call)
+	{
+		indirectCalls.push_back({&call, getNode(call.getCalledOperand())});
+		for (const auto &arg : call.args())
+			if (arg->getType()->isPointerTy())
+				getNode(arg.get());
+		if (call.getType()->isPointerTy())
+			getNode(&call);
+	}
+
+	const CallSummary *findSummary(const Function *callee)
+	{
+		if (!callee)
+			return nullptr;
+		StringRef name = callee->getName();
+		if (callee->getIntrinsicID() != Intrinsic::not_intrinsic)
+			name = Intrinsic::getBaseName(callee->getIntrinsicID());
+		const StringMap<CallSummary> &table = getCallSummaries();
+		auto it = table.find(name);
+		return it == table.end() ? nullptr : &it->second;
+	}
+
+	void collectSummaryEdges(const CallInst &call, const CallSummary &summary)
+	{
+		auto ptrArg = [&](unsigned i) -> const Value *
+		{
+			if (i == CallSummary::Result)
+				return call.getType()->isPointerTy() ? &call : nullptr;
+			if (i < call.arg_size() && call.getArgOperand(i)->getType()->isPointerTy())
+				return call.getArgOperand(i);
+			return nullptr;
+		};
+
+		for (auto [dstArg, srcArg] : summary.copies)
+			if (ptrArg(dstArg) && ptrArg(srcArg))
+				addConstraint(transfer, ptrArg(dstArg), ptrArg(srcArg));
+
+		if (!call.getType()->isPointerTy())
+			return;
+		switch (summary.ret)
+		{
+		case CallSummary::RetNone:
+			break;
+		case CallSummary::RetArg:
+			// The result may point anywhere into the argument's object, as
+			// strchr's does, so with fields it is not tied to the same one.
+			if (const Value *arg = ptrArg(summary.retArg))
+			{
+				if (FieldSensitive)
+					geps.push_back({getNode(&call), getNode(arg), AnyOffset});
+				else
+					addConstraint(copy, &call, arg);
+			}
+			break;
+		// The call is its own heap object; see isAllocCall().
+		case CallSummary::RetAlloc:
+			break;
+		case CallSummary::RetUnknown:
+			unknown.push_back(getNode(&call));
+			break;
+		}
+	}
+
+	// Open-world handling of instructions the constraint builder does not
+	// model: their pointer results may point anywhere, pointers they consume
+	// escape, and calls or atomics may store anything anywhere.
+	void collectOpaque(const Instruction &inst)
+	{
+		if (isa<AllocaInst, ICmpInst>(inst))
+			return;
+		if (auto *ret = dyn_cast<ReturnInst>(&inst))
+		{
+			if (const Value *retVal = ret->getReturnValue())
+				if (retVal->getType()->isPointerTy())
+					escapes.push_back(getNode(retVal));
+			return;
+		}
+
+		for (const Use &op : inst.operands())
+			if (containsPointer(op->getType()))
+			{
+				escapes.push_back(getNode(op.get()));
+				if (!isa<PtrToIntInst>(inst))
+					clobbersMemory = true;
+			}
+		if (inst.getType()->isPointerTy())
+			unknown.push_back(getNode(&inst));
+	}
+
+	void collectConstraints(const Function &F)
+	{
+		for (const BasicBlock &basicBlk : F)
+		{
+			for (const Instruction &inst : basicBlk)
+			{
+				if (auto *sInst = dyn_cast<StoreInst>(&inst))
+				{ // Looks very clumsy >>> Need refactoring
+					const Value *val = sInst->getValueOperand();
+					const Value *ptr = sInst->getPointerOperand();
+					if (TypeFilter && !mayCarryPointer(val->getType(), M.getDataLayout()))
+						continue;
+					const Value *memp, *memV;
+					memp = getPtrObj(ptr);
+					memV = getPtrObj(val);
+					if (memp && memV)
+						addConstraint(addr, memp, memV);
+					else
+						addConstraint(store, ptr, val);
+					if (openWorld && !val->getType()->isPointerTy() && containsPointer(val->getType()))
+						collectOpaque(inst);
+					continue;
+				}
+
+				if (auto *loadInst = dyn_cast<LoadInst>(&inst)){
+					if (TypeFilter && !mayCarryPointer(loadInst->getType(), M.getDataLayout()))
+						continue;
+					const Value *ptr = loadInst->getPointerOperand();
+					addConstraint(load, &inst, ptr);
+					continue;
+				}
+
+				if (auto *bitcastInst = dyn_cast<BitCastInst>(&inst)){
+					if (TypeFilter && !mayCarryPointer(bitcastInst->getType(), M.getDataLayout()))
+						continue;
+					addConstraint(copy, bitcastInst, bitcastInst->getOperand(0));
+					continue;
+				}
+
+				if (auto *gepInst = dyn_cast<GetElementPtrInst>(&inst)){
+					if (keepGeps())
+						geps.push_back({getNode(gepInst), getNode(gepInst->getPointerOperand()), gepOffset(cast<GEPOperator>(*gepInst), M.getDataLayout())});
+					else
+						addConstraint(copy, gepInst, gepInst->getPointerOperand());
+					continue;
+				}
+
+				if (auto *itpInst = dyn_cast<IntToPtrInst>(&inst))
+				{
+					unknown.push_back(getNode(itpInst));
+					continue;
+				}
+
+				if (auto *callInst = dyn_cast<CallInst>(&inst))
+				{
+					const Function *callee = dyn_cast<Function>(callInst->getCalledOperand()->stripPointerCasts());
+					if (openWorld)
+						for (const auto &arg : callInst->args())
+							if (arg->getType()->isPointerTy())
+								escapes.push_back(getNode(arg.get()));
+					if (wholeModule && callee && !callee->isDeclaration())
+					{
+						collectCallEdges(*callInst, *callee);
+						continue;
+					}
+					if (wholeModule && !callee && !callInst->isInlineAsm())
+					{
+						collectIndirectCall(*callInst);
+						continue;
+					}
+					if (const CallSummary *summary = findSummary(callee))
+					{
+						collectSummaryEdges(*callInst, *summary);
+						continue;
+					}
+
+					if (callInst->getType()->isPointerTy())
+						unknown.push_back(getNode(callInst));
+					if (openWorld)
+						clobbersMemory = true;
+
+					SmallVector<const Value *, 8> ptrargs;
+					for (const auto &arg : callInst->args())
+					{
+						if (arg->getType()->isPointerTy())
+							ptrargs.push_back(arg.get());
+					}
+
+					for (const Value *a1 : ptrargs){
+						for (const Value *a2 : ptrargs)
+							addConstraint(store, a1, a2);
+					}
+					continue;
+				}
+
+				if (auto *phi = dyn_cast<PHINode>(&inst))
+				{
+					if (phi->getType()->isPointerTy())
+					{
+						for (unsigned i = 0, n = phi->getNumIncomingValues(); i < n; ++i)
+						{
+							const Value *incomingVal = phi->getIncomingValue(i);
+							if (incomingVal->getType()->isPointerTy())
+								addConstraint(copy, phi, incomingVal);
+						}
+					}
+					continue;
+				}
+
+				if (auto *selectInst = dyn_cast<SelectInst>(&inst))
+				{
+					if (selectInst->getType()->isPointerTy())
+					{
+						const Value *trueVal = selectInst->getTrueValue();
+						const Value *falseVal = selectInst->getFalseValue();
+						if (trueVal->getType()->isPointerTy())
+							addConstraint(copy, selectInst, trueVal);
+						if (falseVal->getType()->isPointerTy())
+							addConstraint(copy, selectInst, falseVal);
+					}
+					continue;
+				}
+
+				if (openWorld)
+					collectOpaque(inst);
+			}
+		}
+
+	}
+
+public:
+	// Cache key part shared by every system of M: the summaries, the data
+	// layout and target (field layout and pointer width, which printing the
+	// IR leaves out) and the global variables. Hashed once per module rather
+	// than once per function.
+	static uint64_t hashModule(const Module &M)
+	{
+		static const std::string summaries = []
+		{
+			if (SummaryFile.empty())
+				return std::string();
+			auto buffer = MemoryBuffer::getFile(SummaryFile);
+			return buffer ? (*buffer)->getBuffer().str() : std::string();
+		}();
+
+		std::string text;
+		raw_string_ostream os(text);
+		os << summaries << '\n';
+		os << M.getDataLayoutStr() << '\n' << M.getTargetTriple() << '\n';
+		for (const GlobalVariable &gv : M.globals())
+			os << gv << '\n';
+		return xxHash64(os.str());
+	}
+
+	// Per-function mode: solves F on its own against the module globals. In
+	// open-world mode F's arguments and anything opaque may point anywhere,
+	// which makes the result safe to answer alias queries with.
+	// `moduleKey` is hashModule(M), for callers analysing many functions.
+	PointerAnalysis(const Function &F, bool openWorld = false, std::optional<uint64_t> moduleKey = std::nullopt) : M(*F.getParent()), openWorld(openWorld), function(&F)
+	{
+		// MY implementation of Andersen's Analysis start here :-)
+
+		collectGlobals();
+		collectAllocas(F);
+		collectHeapSites(F);
+		finishObjects();
+		collectGlobalInits();
+		if (openWorld)
+			for (const Argument &arg : F.args())
+				if (arg.getType()->isPointerTy())
+					unknown.push_back(getNode(&arg));
+		collectConstraints(F);
+		if (!CacheDir.empty())
+			hashInputs(&F, moduleKey ? *moduleKey : hashModule(M));
+		solve();
+	}
+
+	// Whole-module mode: one constraint system covering every function, with
+	// pointer arguments and return values passed across direct calls. Globals
+	// are registered and their initializers processed once, not per function.
+	PointerAnalysis(const Module &Mod) : M(Mod), wholeModule(true)
+	{
+		collectGlobals();
+		collectFunctions();
+		for (const Function &F : M)
+		{
+			collectAllocas(F);
+			collectHeapSites(F);
+		}
+		finishObjects();
+		collectCallees();
+		collectGlobalInits();
+		for (const Function &F : M)
+			collectConstraints(F);
+		if (!CacheDir.empty())
+			hashInputs(nullptr, hashModule(M));
+		solve();
+	}
+
+	// Every IR value with a node; slots of forgotten values are null.
+	ArrayRef<const Value *> values() const { return nodeValues; }
+
+	// The memory object and byte offset into it that ptr points at, when it
+	// is the object's address plus a constant.
+	std::optional<std::pair<NodeID, uint64_t>> exactOffset(const Value *ptr)
+	{
+		const DataLayout &DL = M.getDataLayout();
+		APInt offset(DL.getIndexTypeSizeInBits(ptr->getType()), 0);
+		const Value *base = ptr->stripAndAccumulateConstantOffsets(DL, offset, /*AllowNonInbounds=*/true);
+		if (!memObj.count(base) || offset.isNegative())
+			return std::nullopt;
+		return std::make_pair(nodeIDs.lookup(base), offset.getZExtValue());
+	}
+
+	// Drops a value deleted from the IR, so that a new value allocated at its
+	// address is not taken for it. Its node stays in the graph, unnamed.
+	void forget(const Value *val)
+	{
+		auto it = nodeIDs.find(val);
+		if (it == nodeIDs.end())
+			return;
+		nodeValues[it->second] = nullptr;
+		nodeIDs.erase(it);
+		memObj.erase(val);
+		exposed.reset();
+	}
+
+	// Objects ptr may refer to, or nothing when the analysis cannot tell.
+	std::optional<PtsSet> pointeesOf(const Value *ptr)
+	{
+		auto it = nodeIDs.find(ptr);
+		if (it == nodeIDs.end())
+		{
+			NodeID direct = getPtrObj(ptr) ? nodeIDs.lookup(getPtrObj(ptr)) : constantField(ptr);
+			if (direct == NoObj)
+				return std::nullopt;
+			PtsSet self;
+			self.set(direct);
+			return self;
+		}
+		PtsSet set = nodePointees(it->second);
+		if (set.empty())
+			return std::nullopt;
+		return set;
+	}
+
+	// Objects whose address may be visible outside the function's own pointer
+	// values: globals, anything stored in memory, passed to a call or returned.
+	// Only these can be reached through a pointer to the unknown object.
+	const PtsSet &exposedObjects()
+	{
+		if (exposed)
+			return *exposed;
+		if (demandDriven)
+		{
+			for (NodeID obj = 0; obj < numObjects; ++obj)
+				activate(obj);
+			for (NodeID node : escapes)
+				activate(node);
+			drain();
+		}
+		exposed.emplace();
+		for (NodeID obj = 0; obj < numObjects; ++obj)
+		{
+			if (isa_and_nonnull<GlobalVariable>(nodeValues[objFields[obj].base]))
+				exposed->set(obj);
+			*exposed |= pool.get(pointsTo[find(obj)]);
+		}
+		for (NodeID node : escapes)
+			*exposed |= nodePointees(node);
+		exposed->reset(unknownObj);
+		// Code holding the address of one field can reach all of them.
+		widenFields(*exposed, std::nullopt);
+		return *exposed;
+	}
+
+	// An access of `size` bytes through a pointer to a field may run into the
+	// fields after it; one of unknown size may touch any field of the object.
+	// Through a pointer into the middle of a field, the access may start as
+	// late as the field's last byte, unless `at` gives the object and byte
+	// offset the pointer is known to be at.
+	void widenFields(PtsSet &set, std::optional<uint64_t> size, std::optional<std::pair<NodeID, uint64_t>> at = std::nullopt)
+	{
+		PtsSet extra;
+		for (NodeID obj : set)
+		{
+			const ObjectField &field = objFields[obj];
+			NodeID last = field.base + field.count;
+			uint64_t from = field.start;
+			if (at && at->first == field.base)
+				from = at->second;
+			else if (interiorFields.test(obj))
+				from = (obj + 1 < last ? objFields[obj + 1].start : field.baseSize) - 1;
+			for (NodeID node = field.base; node < last; ++node)
+				if (!size || (node > obj && objFields[node].start < from + *size))
+					extra.set(node);
+		}
+		set |= extra;
+	}
+
+	// Sizes are the access sizes in bytes starting at each pointer, if known.
+	bool mayAlias(const Value *ptrA, std::optional<uint64_t> sizeA, const Value *ptrB, std::optional<uint64_t> sizeB)
+	{
+		std::optional<PtsSet> ptsA = pointeesOf(ptrA), ptsB = pointeesOf(ptrB);
+		if (!ptsA || !ptsB)
+			return true;
+		widenFields(*ptsA, sizeA, exactOffset(ptrA));
+		widenFields(*ptsB, sizeB, exactOffset(ptrB));
+		if (ptsA->intersects(*ptsB))
+			return true;
+		if (ptsA->test(unknownObj))
+			return ptsB->intersects(exposedObjects());
+		if (ptsB->test(unknownObj))
+			return ptsA->intersects(exposedObjects());
+		return false;
+	}
+
+	// A constraint in terms of IR values, for update(). `dst` is the value
+	// written, or for a store the pointer written through. For AddressOf
+	// `src` is the memory object; `offset` is only used by GEPs.
+	struct ConstraintEdit
+	{
+		ConstraintKind kind;
+		const Value *dst, *src;
+		int64_t offset = 0;
+	};
+
+	// Brings the solution up to date with an edit of the IR, without
+	// starting over: added constraints only push what is new through the
+	// graph, and removed ones only clear and re-solve what they may have
+	// contributed to. Returns false, changing nothing, when the
+	// edit cannot be done in place: under unification or with registers
+	// split off by partial SSA, for memory objects
+	// the analysis has not numbered, and for removals involving variables
+	// that offline substitution merged. Build a new analysis then.
+	bool update(ArrayRef<ConstraintEdit> added, ArrayRef<ConstraintEdit> removed = {})
+	{
+		// Results loaded from the cache come without the constraint graph
+		// that edits would be propagated along.
+		if (unification || stats.cached || !registers.empty())
+			return false;
+		auto unnumberedObject = [&](const Value *val)
+		{
+			const Value *base = val->stripPointerCasts();
+			return (isa<AllocaInst>(base) || isa<GlobalVariable>(base) || isAllocCall(base)) && !memObj.count(base);
+		};
+		// Mirrors collectConstraints(): a store of an object's address
+		// straight into an object is an address-of constraint.
+		auto normalize = [&](ConstraintEdit edit)
+		{
+			if (edit.kind == ConstraintKind::Gep && !keepGeps())
+				edit.kind = ConstraintKind::Copy;
+			if (edit.kind == ConstraintKind::Store && getPtrObj(edit.dst) && getPtrObj(edit.src))
+				edit = {ConstraintKind::AddressOf, getPtrObj(edit.dst), getPtrObj(edit.src)};
+			return edit;
+		};
+
+		SmallVector<ConstraintEdit, 8> additions;
+		for (const ConstraintEdit &edit : added)
+		{
+			if (unnumberedObject(edit.dst) || unnumberedObject(edit.src))
+				return false;
+			if (edit.kind == ConstraintKind::AddressOf && !getPtrObj(edit.src) && !(FieldSensitive && constantField(edit.src) != NoObj))
+				return false;
+			additions.push_back(normalize(edit));
+		}
+		SmallVector<NodeConstraint, 8> removals;
+		for (const ConstraintEdit &edit : removed)
+		{
+			ConstraintEdit norm = normalize(edit);
+			auto dst = nodeIDs.find(norm.dst), src = nodeIDs.find(norm.src);
+			if (dst == nodeIDs.end() || src == nodeIDs.end())
+				continue;
+			if (offlineMerged.size() && (offlineMerged.test(dst->second) || offlineMerged.test(src->second)))
+				return false;
+			removals.push_back({norm.kind, dst->second, src->second, norm.offset});
+		}
+
+		// The steps below need every constraint wired in.
+		if (demandDriven)
+		{
+			for (NodeID node = 0; node < nodeValues.size(); ++node)
+				activate(node);
+			drain();
+			demandDriven = false;
+		}
+		for (const NodeConstraint &c : dropped)
+			addLateConstraint(c);
+		dropped.clear();
+		exposed.reset();
+
+		if (!removals.empty())
+			removeConstraints(removals);
+		for (const ConstraintEdit &edit : additions)
+		{
+			NodeConstraint c = {edit.kind, getNode(edit.dst), getNode(edit.src), edit.offset};
+			growTables();
+			addLateConstraint(c);
+		}
+		drain();
+		return true;
+	}
+
+	// The constraints collectConstraints() gives an instruction that derives
+	// a pointer from other values: casts, GEPs, phis and selects. False for
+	// anything else.
+	bool derivedConstraints(const Instruction &inst, SmallVectorImpl<ConstraintEdit> &edits)
+	{
+		if (!inst.getType()->isPointerTy())
+			return false;
+		if (isa<BitCastInst>(inst))
+			edits.push_back({ConstraintKind::Copy, &inst, inst.getOperand(0)});
+		else if (auto *gep = dyn_cast<GetElementPtrInst>(&inst))
+			edits.push_back({ConstraintKind::Gep, gep, gep->getPointerOperand(), gepOffset(cast<GEPOperator>(*gep), M.getDataLayout())});
+		else if (isa<PHINode, SelectInst>(inst))
+		{
+			for (const Value *op : inst.operands())
+				if (op->getType()->isPointerTy())
+					edits.push_back({ConstraintKind::Copy, &inst, op});
+		}
+		else
+			return false;
+		return true;
+	}
+
+	bool numbered(const Value *val) const { return nodeIDs.count(val); }
+
+	// Adds a pointer that a pass created after the solve through update(),
+	// when it is derived from values the analysis knows, numbering new
+	// operands first. Loads are left out: they would miss what stores
+	// created along with them write. Returns whether val is known now.
+	bool addValue(const Value *val, unsigned depth = 0)
+	{
+		if (nodeIDs.count(val) || isa<ConstantPointerNull, UndefValue>(val))
+			return true;
+		auto *inst = dyn_cast<Instruction>(val);
+		if (!inst || !inst->getParent() || inst->getFunction() != function || depth > 8)
+			return false;
+		SmallVector<ConstraintEdit, 4> edits;
+		if (!derivedConstraints(*inst, edits))
+			return false;
+		for (const ConstraintEdit &edit : edits)
+			if (!addValue(edit.src, depth + 1))
+				return false;
+		return update(edits);
+	}
+
+	bool mayBeExposed(const Value *ptr)
+	{
+		std::optional<PtsSet> pts = pointeesOf(ptr);
+		if (!pts || pts->test(unknownObj))
+			return true;
+		return pts->intersects(exposedObjects());
+	}
+
+	// One JSON record of this solve for -pta-stats. Set sizes are those of
+	// the nodes standing for IR values, bucketed by powers of two: 0, 1, 2,
+	// 3-4, 5-8 and so on.
+	void writeStats(json::OStream &J, StringRef name)
+	{
+		static const char *const KindNames[] = {"addr", "copy", "load", "store", "gep"};
+		std::vector<uint64_t> sizes;
+		for (NodeID node = 0; node < nodeValues.size(); ++node)
+		{
+			if (!nodeValues[node])
+				continue;
+			unsigned size = pool.get(pointsTo[find(node)]).count();
+			unsigned bucket = size ? Log2_32_Ceil(size) + 1 : 0;
+			if (sizes.size() <= bucket)
+				sizes.resize(bucket + 1);
+			++sizes[bucket];
+		}
+
+		J.object([&]
+		{
+			J.attribute("name", name);
+			J.attribute("solver", unification ? "steensgaard" : demandDriven ? "demand" : ParallelSolve ? "parallel" : "andersen");
+			J.attribute("cached", stats.cached);
+			J.attribute("overBudget", stats.overBudget);
+			J.attribute("nodes", uint64_t(nodeValues.size()));
+			J.attribute("objects", uint64_t(numObjects));
+			J.attribute("registersSplit", uint64_t(registers.size()));
+			J.attribute("constraints", uint64_t(stats.constraints));
+			J.attribute("rounds", stats.rounds);
+			J.attribute("nodeVisits", stats.nodeVisits);
+			J.attribute("propagated", stats.propagated);
+			J.attribute("merged", stats.merged);
+			J.attributeObject("visits", [&]
+			{
+				for (unsigned kind = 1; kind < 5; ++kind)
+					J.attribute(KindNames[kind], stats.visits[kind]);
+			});
+			J.attributeObject("seconds", [&]
+			{
+				J.attribute("solve", stats.solveSeconds);
+				for (unsigned kind = 1; kind < 5; ++kind)
+					J.attribute(KindNames[kind], stats.seconds[kind]);
+			});
+			J.attribute("sets", uint64_t(pool.size()));
+			J.attribute("setElements", uint64_t(pool.numElements()));
+			J.attributeObject("setSizes", [&]
+			{
+				for (unsigned bucket = 0; bucket < sizes.size(); ++bucket)
+				{
+					if (bucket < 3)
+						J.attribute(std::to_string(bucket), sizes[bucket]);
+					else
+						J.attribute(std::to_string((1u << (bucket - 2)) + 1) + "-" + std::to_string(1u << (bucket - 1)), sizes[bucket]);
+				}
+			});
+		});
+	}
+
+	// Names of the objects both values may point to, one per object and
+	// sorted; nothing when either value is not part of the analysis.
+	std::optional<std::vector<std::string>> commonObjects(const Value *valA, const Value *valB, const NameIndex &names)
+	{
+		const PtsSet *ptsA = lookupPtsToSet(valA);
+		const PtsSet *ptsB = lookupPtsToSet(valB);
+		if (!ptsA || !ptsB)
+			return std::nullopt;
+		return commonObjects(*ptsA, *ptsB, names);
+	}
+
+	std::vector<std::string> commonObjects(const PtsSet &ptsA, const PtsSet &ptsB, const NameIndex &names)
+	{
+		std::vector<std::string> common;
+		NodeID lastBase = NoObj;
+		for (NodeID obj : expandUnknown(ptsA) & expandUnknown(ptsB))
+		{
+			// Fields are reported under the name of their object, once.
+			if (objFields[obj].base == lastBase)
+				continue;
+			lastBase = objFields[obj].base;
+			StringRef name = names.nameOf(nodeValues[lastBase]);
+			if (!name.empty())
+				common.push_back(name.str());
+		}
+		std::sort(common.begin(), common.end());
+		return common;
+	}
+
+	// The example query: the objects both `a` and `b` may point to.
+	void report(const Function &F, const NameIndex &names)
+	{
+		if (auto common = commonObjects(names.lookup(F, "a"), names.lookup(F, "b"), names))
+			printObjects(llvm::errs(), *common);
+		else
+			llvm::errs() << "Not sure what's happening here";
+		llvm::errs() << "\n";
+	}
+
+	// Whole-module mode: the callees of each function as a DOT graph.
+	// Direct calls are solid edges, callees found through the points-to
+	// sets of called pointers dashed, and a call that may go anywhere has a
+	// dashed edge to the "unknown" node.
+	void writeCallGraph(raw_ostream &os)
+	{
+		auto edge = [&](const Function &caller, StringRef callee, bool dashed)
+		{
+			os << "\t\"" << DOT::EscapeString(caller.getName().str()) << "\" -> \"" << DOT::EscapeString(callee.str()) << "\"";
+			if (dashed)
+				os << " [style=dashed]";
+			os << ";\n";
+		};
+
+		os << "digraph \"callgraph\" {\n";
+		for (const Function &F : M)
+		{
+			if (F.isIntrinsic())
+				continue;
+			SetVector<const Function *> direct, resolved;
+			bool callsUnknown = false;
+			for (const BasicBlock &basicBlk : F)
+				for (const Instruction &inst : basicBlk)
+				{
+					auto *call = dyn_cast<CallInst>(&inst);
+					if (!call || call->isInlineAsm())
+						continue;
+					if (auto *callee = dyn_cast<Function>(call->getCalledOperand()->stripPointerCasts()))
+					{
+						if (!callee->isIntrinsic())
+							direct.insert(callee);
+						continue;
+					}
+					for (NodeID obj : nodePointees(nodeIDs.lookup(call->getCalledOperand())))
+					{
+						if (obj == unknownObj)
+							callsUnknown = true;
+						else if (auto *callee = dyn_cast_or_null<Function>(nodeValues[obj]))
+							resolved.insert(callee);
+					}
+				}
+
+			os << "\t\"" << DOT::EscapeString(F.getName().str()) << "\";\n";
+			for (const Function *callee : direct)
+				edge(F, callee->getName(), false);
+			for (const Function *callee : resolved)
+				if (!direct.count(callee))
+					edge(F, callee->getName(), true);
+			if (callsUnknown)
+				edge(F, "unknown", true);
+		}
+		os << "}\n";
+	}
+};
+
+// Flow-sensitive refinement of a solved PointerAnalysis for one function,
+// after Hardekopf and Lin's staged analysis. MemorySSA says which
+// instructions define memory and places phis where definitions meet, so
+// contents only need tracking at definitions: each block keeps the objects
+// it writes, and anything it does not write is looked up at the block's
+// memory phi or, with no phi, at the end of its immediate dominator.
+// Registers are in SSA form and keep one set each. Where the pre-analysis
+// cannot be refined (the unknown object, calls, values it does not model)
+// its sets are used as they are, and refined sets never exceed them.
+//
+// A store through a pointer to one object that exists once (a global, or a
+// static alloca of a function that is not recursive) and that is exactly a
+// pointer slot replaces the object's contents: a strong update. Other
+// stores add to them. Allocas of such functions start out empty.
+class FlowSensitiveAnalysis
+{
+	// Contents of the objects a block writes, as of its end. After a call
+	// that may write anything, other objects hold what the pre-analysis says.
+	struct BlockState
+	{
+		llvm::DenseMap<NodeID, PtsID> written;
+		bool clobbered = false;
+	};
+
+	PointerAnalysis &pre;
+	const Function &F;
+	MemorySSA &MSSA;
+	bool recursive;
+	// Pointer registers of F, except objects, which point to themselves.
+	llvm::DenseMap<const Value *, PtsID> regs;
+	llvm::DenseMap<const BasicBlock *, BlockState> blocks;
+	// Contents of objects at each memory phi, for the objects asked about.
+	llvm::DenseMap<const MemoryPhi *, llvm::DenseMap<NodeID, PtsID>> phis;
+	// Entry contents of the blocks visited so far in the current pass, which
+	// no longer change in it. Blocks are numbered in reverse post-order.
+	llvm::DenseMap<std::pair<const BasicBlock *, NodeID>, PtsID> entries;
+	llvm::DenseMap<const BasicBlock *, unsigned> order;
+	unsigned visiting = 0;
+	bool changed = false;
+
+	PtsSetPool &pool() { return pre.pool; }
+
+	PtsID flowInsensitive(NodeID node)
+	{
+		pre.solveFor(node);
+		return pre.pointsTo[pre.find(node)];
+	}
+
+	void update(PtsID &slot, PtsID value)
+	{
+		PtsID grown = pool().unionOf(slot, value);
+		if (grown != slot)
+		{
+			slot = grown;
+			changed = true;
+		}
+	}
+
+	// What val points to as an operand.
+	PtsID operand(const Value *val)
+	{
+		auto it = pre.nodeIDs.find(val);
+		if (it == pre.nodeIDs.end())
+		{
+			NodeID direct = pre.getPtrObj(val) ? pre.nodeIDs.lookup(pre.getPtrObj(val)) : pre.constantField(val);
+			return direct == PointerAnalysis::NoObj ? PtsSetPool::EmptySet : pool().insert(PtsSetPool::EmptySet, direct);
+		}
+		if (pre.directObjs[it->second] != PointerAnalysis::NoObj)
+			return pool().insert(PtsSetPool::EmptySet, pre.directObjs[it->second]);
+		auto reg = regs.find(val);
+		return reg != regs.end() ? reg->second : flowInsensitive(it->second);
+	}
+
+	static bool isRefined(const Instruction &I)
+	{
+		return isa<LoadInst>(I) || isa<GetElementPtrInst>(I) || isa<PHINode>(I) || isa<SelectInst>(I) || isa<BitCastInst>(I) || isa<AddrSpaceCastInst>(I) || isa<FreezeInst>(I);
+	}
+
+	// Definitions that cannot put a pointer into memory.
+	static bool storesNoPointers(const Instruction &I)
+	{
+		if (isa<FenceInst>(I) || isa<MemSetInst>(I) || I.isLifetimeStartOrEnd())
+			return true;
+		const auto *intrinsic = dyn_cast<IntrinsicInst>(&I);
+		return intrinsic && intrinsic->isAssumeLikeIntrinsic();
+	}
+
+	const AllocaInst *ownAlloca(NodeID obj)
+	{
+		const auto *alloca = dyn_cast_or_null<AllocaInst>(pre.nodeValues[pre.objFields[obj].base]);
+		return alloca && alloca->getFunction() == &F ? alloca : nullptr;
+	}
+
+	// A store can replace obj's contents when obj is a single pointer slot
+	// that exists once and the store covers it.
+	bool isStrong(NodeID obj, const StoreInst &store)
+	{
+		if (obj == pre.unknownObj)
+			return false;
+		Type *ty = pre.objFields[obj].type;
+		if (!ty || !ty->isPointerTy())
+			return false;
+		const DataLayout &DL = F.getParent()->getDataLayout();
+		TypeSize stored = DL.getTypeStoreSize(store.getValueOperand()->getType());
+		if (stored.isScalable() || stored.getFixedValue() < DL.getTypeStoreSize(ty).getFixedValue())
+			return false;
+		if (isa_and_nonnull<GlobalVariable>(pre.nodeValues[pre.objFields[obj].base]))
+			return true;
+		const AllocaInst *alloca = ownAlloca(obj);
+		return alloca && !recursive && alloca->isStaticAlloca() && !alloca->isArrayAllocation();
+	}
+
+	// The contents of obj when BB starts.
+	PtsID atEntry(const BasicBlock *BB, NodeID obj)
+	{
+		auto it = entries.find({BB, obj});
+		if (it != entries.end())
+			return it->second;
+		PtsID value;
+		if (const MemoryPhi *phi = MSSA.getMemoryAccess(BB))
+		{
+			// Filled in when the block is next visited.
+			auto [slot, fresh] = phis[phi].try_emplace(obj, PtsSetPool::EmptySet);
+			if (fresh)
+				changed = true;
+			value = slot->second;
+		}
+		else if (const DomTreeNode *idom = MSSA.getDomTree().getNode(BB)->getIDom())
+			value = atExit(idom->getBlock(), obj);
+		else
+			value = !recursive && ownAlloca(obj) ? PtsSetPool::EmptySet : flowInsensitive(obj);
+		if (order.lookup(BB) <= visiting)
+			entries[{BB, obj}] = value;
+		return value;
+	}
+
+	// The contents of obj when BB ends, as of the last visit of BB.
+	PtsID atExit(const BasicBlock *BB, NodeID obj)
+	{
+		if (!order.count(BB))
+			return PtsSetPool::EmptySet;
+		auto it = blocks.find(BB);
+		if (it != blocks.end())
 		{
-			set.insert(val);
-			return true;
+			auto found = it->second.written.find(obj);
+			if (found != it->second.written.end())
+				return found->second;
+			if (it->second.clobbered)
+				return flowInsensitive(obj);
 		}
-		return false;
+		return atEntry(BB, obj);
 	}
 
-	SmallPtrSet<const Value *, 16> getPtsToSet(const Value *src, const llvm::DenseMap<const Value *, SmallPtrSet<const Value *, 8>> &pointsTo)
+	// Contents of obj at the current point of a block being visited.
+	PtsID current(const BasicBlock *BB, const BlockState &state, NodeID obj)
 	{
-		SmallPtrSet<const Value *, 16> am;
-		if (const Value *direct = getPtrObj(src))
-			am.insert(direct);
-		auto it = pointsTo.find(src);
-		if (it != pointsTo.end())
-			am.insert(it->second.begin(), it->second.end());
-
-		return am;
+		auto found = state.written.find(obj);
+		if (found != state.written.end())
+			return found->second;
+		return state.clobbered ? flowInsensitive(obj) : atEntry(BB, obj);
 	}
 
-	Type *getType(const Value *memObj)
+	void visitPhi(const BasicBlock *BB, const MemoryPhi *phi)
 	{
-		if (const AllocaInst *alloc = dyn_cast<AllocaInst>(memObj))
-			return alloc->getAllocatedType();
-		else if (const GlobalVariable *globalvar = dyn_cast<GlobalVariable>(memObj))
-			return globalvar->getValueType();
-		return nullptr;
+		auto found = phis.find(phi);
+		if (found == phis.end())
+			return;
+		SmallVector<NodeID, 8> objs;
+		for (const auto &entry : found->second)
+			objs.push_back(entry.first);
+		for (NodeID obj : objs)
+		{
+			PtsID value = PtsSetPool::EmptySet;
+			for (unsigned i = 0; i < phi->getNumIncomingValues(); ++i)
+				value = pool().unionOf(value, atExit(phi->getIncomingBlock(i), obj));
+			update(phis[phi][obj], value);
+			entries[{BB, obj}] = phis[phi][obj];
+		}
 	}
 
-	const Value *getPtrOpd(const Constant *cons)
+	void visitStore(const BasicBlock *BB, BlockState &state, const StoreInst &store)
 	{
-		if (!cons)
-			return nullptr;
-		if (auto *constt = dyn_cast<ConstantExpr>(cons))
+		PtsID targets = operand(store.getPointerOperand());
+		PtsID value = store.getValueOperand()->getType()->isPointerTy() ? operand(store.getValueOperand()) : PtsSetPool::EmptySet;
+		const PtsSet &set = pool().get(targets);
+		// Through the unknown object, any object may be written.
+		if (set.test(pre.unknownObj))
 		{
-			if (constt->getOpcode() == Instruction::BitCast || constt->getOpcode() == Instruction::GetElementPtr)
-			{
-				if (auto *op = dyn_cast<Constant>(constt->getOperand(0)))
-					return getPtrOpd(op);
-			}
+			state.written.clear();
+			state.clobbered = true;
+			return;
 		}
-		else if (getPtrObj(cons))
+		if (set.count() == 1 && isStrong(set.find_first(), store))
 		{
-			return cons;
+			state.written[set.find_first()] = value;
+			return;
+		}
+		for (NodeID obj : set)
+		{
+			PtsID contents = pool().unionOf(current(BB, state, obj), value);
+			state.written[obj] = contents;
 		}
-		return nullptr;
 	}
 
-	bool pCopy(llvm::DenseMap<const Value *, SmallPtrSet<const Value *, 8>> &pointsTo)
+	PtsID refine(const BasicBlock *BB, const BlockState &state, const Instruction &I)
 	{
-		bool modified = false;
-		for (auto &[dest, src] : copy)
+		PtsID whole = flowInsensitive(pre.nodeIDs.lookup(&I));
+		if (const auto *load = dyn_cast<LoadInst>(&I))
 		{
-			auto targets = getPtsToSet(src, pointsTo);
-			auto &dstSet = pointsTo[dest];
-			for (const Value *t : targets)
-				modified |= insertIfAbsent(dstSet, t);
+			PtsID ptr = operand(load->getPointerOperand());
+			if (pool().get(ptr).test(pre.unknownObj))
+				return whole;
+			PtsID value = PtsSetPool::EmptySet;
+			for (NodeID obj : pool().get(ptr))
+				value = pool().unionOf(value, current(BB, state, obj));
+			return pool().intersectionOf(value, whole);
 		}
-		return modified;
+		if (const auto *gep = dyn_cast<GetElementPtrInst>(&I))
+		{
+			// The fields of the objects the base may point into.
+			const PtsSet &src = pool().get(operand(gep->getPointerOperand()));
+			if (src.test(pre.unknownObj))
+				return whole;
+			PtsSet bases, fields;
+			for (NodeID obj : src)
+				bases.set(pre.objFields[obj].base);
+			for (NodeID obj : pool().get(whole))
+				if (bases.test(pre.objFields[obj].base))
+					fields.set(obj);
+			return pool().intern(std::move(fields));
+		}
+		PtsID value = PtsSetPool::EmptySet;
+		for (const Value *op : I.operands())
+			if (op->getType()->isPointerTy())
+				value = pool().unionOf(value, operand(op));
+		if (pool().get(value).test(pre.unknownObj))
+			return whole;
+		return pool().intersectionOf(value, whole);
 	}
-	// copy working fine and needs some additional testing
 
-	bool pLoad(llvm::DenseMap<const Value *, SmallPtrSet<const Value *, 8>> &pointsTo)
+	// Registers and phis only grow, so repeating passes in reverse
+	// post-order reaches the fixpoint; loops take an extra pass or two. A
+	// pass that needs an object at a phi for the first time takes another.
+	void iterate()
 	{
-		bool modified = false;
-		for (auto &[dest, srcPtr] : load)
+		ReversePostOrderTraversal<const Function *> rpo(&F);
+		for (const BasicBlock *BB : rpo)
+			order.try_emplace(BB, order.size() + 1);
+		do
 		{
-			auto ptrTargets = getPtsToSet(srcPtr, pointsTo);
-			auto &destSet = pointsTo[dest];
-			for (const Value *memObj : ptrTargets)
+			changed = false;
+			entries.clear();
+			for (const BasicBlock *BB : rpo)
 			{
-				auto it = pointsTo.find(memObj);
-				if (it == pointsTo.end())
-					continue;
-				for (const Value *t : it->second)
+				visiting = order.lookup(BB);
+				if (const MemoryPhi *phi = MSSA.getMemoryAccess(BB))
+					visitPhi(BB, phi);
+				BlockState state;
+				for (const Instruction &I : *BB)
 				{
-					modified |= insertIfAbsent(destSet, t);
+					auto reg = regs.find(&I);
+					if (reg != regs.end() && isRefined(I))
+					{
+						PtsID value = refine(BB, state, I);
+						update(regs[&I], value);
+					}
+					if (!isa_and_nonnull<MemoryDef>(MSSA.getMemoryAccess(&I)) || storesNoPointers(I))
+						continue;
+					// Stores of aggregates holding pointers are left to the
+					// pre-analysis, like calls.
+					const auto *store = dyn_cast<StoreInst>(&I);
+					if (store && (store->getValueOperand()->getType()->isPointerTy() || !containsPointer(store->getValueOperand()->getType())))
+						visitStore(BB, state, *store);
+					else
+					{
+						state.written.clear();
+						state.clobbered = true;
+					}
 				}
+				blocks[BB] = std::move(state);
 			}
-		}
-		return modified;
+		} while (changed);
+		visiting = order.size();
 	}
 
-	bool pStore(llvm::DenseMap<const Value *, SmallPtrSet<const Value *, 8>> &pointsTo)
+public:
+	// `recursive` says whether F may be active more than once, in which case
+	// its allocas are not single objects.
+	FlowSensitiveAnalysis(PointerAnalysis &pre, const Function &F, MemorySSA &MSSA, bool recursive) : pre(pre), F(F), MSSA(MSSA), recursive(recursive)
 	{
-		bool modified = false;
+		for (const BasicBlock &BB : F)
+			for (const Instruction &I : BB)
+			{
+				auto node = pre.nodeIDs.find(&I);
+				if (I.getType()->isPointerTy() && node != pre.nodeIDs.end() && pre.directObjs[node->second] == PointerAnalysis::NoObj)
+					regs[&I] = isRefined(I) ? PtsSetPool::EmptySet : flowInsensitive(node->second);
+			}
+		iterate();
+	}
 
-		for (auto &[ptrOp, srcVal] : store)
+	// The contents of obj when F returns.
+	PtsSet contentsAtExit(NodeID obj)
+	{
+		while (true)
 		{
-			SmallPtrSet<const Value *, 16> ptrTargets = getPtsToSet(ptrOp, pointsTo);
-			SmallPtrSet<const Value *, 16> srcTargets = getPtsToSet(srcVal, pointsTo);
-
-			for (const Value *memObj : ptrTargets){
-				Type *ht = getType(memObj);
-				if (!ht || !ht->isPointerTy())
-					continue;
-
-				auto &memSet = pointsTo[memObj];
-				for (const Value *t : srcTargets)
+			changed = false;
+			PtsID value = PtsSetPool::EmptySet;
+			bool returns = false;
+			for (const BasicBlock &BB : F)
+				if (isa<ReturnInst>(BB.getTerminator()) && MSSA.getDomTree().isReachableFromEntry(&BB))
 				{
-					if (insertIfAbsent(memSet, t))
-						modified = true;
+					returns = true;
+					value = pool().unionOf(value, atExit(&BB, obj));
 				}
-			}
+			if (!returns)
+				return pool().get(flowInsensitive(obj));
+			// Phis that had not tracked obj yet are solved first.
+			if (!changed)
+				return pool().get(value);
+			iterate();
 		}
+	}
 
-		return modified;
+	// What the variable val names points to: the contents of a memory object
+	// when F returns, or the set of a pointer register.
+	std::optional<PtsSet> variable(const Value *val)
+	{
+		auto it = pre.nodeIDs.find(val);
+		if (!val || it == pre.nodeIDs.end())
+			return std::nullopt;
+		if (it->second < pre.numObjects)
+			return contentsAtExit(it->second);
+		return pool().get(operand(val));
 	}
 
+	std::optional<std::vector<std::string>> commonObjects(const Value *valA, const Value *valB, const NameIndex &names)
+	{
+		std::optional<PtsSet> ptsA = variable(valA), ptsB = variable(valB);
+		if (!ptsA || !ptsB)
+			return std::nullopt;
+		return pre.commonObjects(*ptsA, *ptsB, names);
+	}
 
-public:
-	PointerAnalysis(const Function &F) : Fn(F)
+	// The example query, at F's exit.
+	void report(const NameIndex &names)
 	{
+		if (auto common = commonObjects(names.lookup(F, "a"), names.lookup(F, "b"), names))
+			printObjects(llvm::errs(), *common);
+		else
+			llvm::errs() << "Not sure what's happening here";
+		llvm::errs() << "\n";
+	}
+};
 
-		llvm::DenseMap<const Value *, SmallPtrSet<const Value *, 8>> pointsTo; /* You MUST use this Map*/
+// Builds the flow-sensitive refinement of each function's results under
+// -pta-flow-sensitive. Recursion is read off the direct call graph, plus
+// the cycles that code outside the module may close: that code can call
+// back into any function whose address is taken.
+class FlowRefiner
+{
+	FunctionAnalysisManager *FAM = nullptr;
+	llvm::DenseSet<const Function *> recursive;
 
-		// You don’t need to handle conversion from addresses back to variable names.
-		// The code below will take care of that automatically as long as you correctly
-		
+	// Indirect calls and calls to bodiless functions other than intrinsics
+	// and summarized library functions, which never call back.
+	static bool callsUnknown(const CallBase &call)
+	{
+		if (call.isInlineAsm())
+			return false;
+		const Function *callee = call.getCalledFunction();
+		if (!callee)
+			return true;
+		return callee->isDeclaration() && !callee->isIntrinsic() && !getCallSummaries().count(callee->getName());
+	}
 
-		// MY implementation of Andersen's Analysis start here :-)
+public:
+	FlowRefiner(Module &M, ModuleAnalysisManager &AM)
+	{
+		if (!FlowSensitive)
+			return;
+		FAM = &AM.getResult<FunctionAnalysisManagerModuleProxy>(M).getManager();
+		CallGraph CG(M);
+		for (auto scc = scc_begin(&CG); !scc.isAtEnd(); ++scc)
+			if (scc.hasCycle())
+				for (CallGraphNode *node : *scc)
+					if (node->getFunction())
+						recursive.insert(node->getFunction());
 
-		const Module *M = Fn.getParent();
-		for (auto &gVar : M->globals())
-			memObj.insert(&gVar);
+		// A function is active twice when unknown code re-enters the module
+		// through an address-taken function that leads back to it, so mark
+		// everything on a direct-call path from such a function to an
+		// unknown call.
+		DenseMap<const Function *, SmallVector<const Function *, 4>> callers, callees;
+		SmallVector<const Function *, 16> work;
+		llvm::DenseSet<const Function *> reachesUnknown;
+		for (const Function &F : M)
+			for (const BasicBlock &basicBlk : F)
+				for (const Instruction &inst : basicBlk)
+					if (const auto *call = dyn_cast<CallBase>(&inst))
+					{
+						if (callsUnknown(*call))
+						{
+							if (reachesUnknown.insert(&F).second)
+								work.push_back(&F);
+						}
+						else if (const Function *callee = call->getCalledFunction(); callee && !callee->isDeclaration())
+						{
+							callers[callee].push_back(&F);
+							callees[&F].push_back(callee);
+						}
+					}
+		while (!work.empty())
+			for (const Function *caller : callers.lookup(work.pop_back_val()))
+				if (reachesUnknown.insert(caller).second)
+					work.push_back(caller);
 
-		for (auto &basicBlk : Fn)
+		llvm::DenseSet<const Function *> reentered;
+		for (const Function *F : reachesUnknown)
+			if (F->hasAddressTaken() && reentered.insert(F).second)
+				work.push_back(F);
+		while (!work.empty())
 		{
-			for (auto &inst : basicBlk)
-			{
-				if (auto *A = dyn_cast<AllocaInst>(&inst))
-					memObj.insert(A);
-			}
+			const Function *F = work.pop_back_val();
+			recursive.insert(F);
+			for (const Function *callee : callees.lookup(F))
+				if (reachesUnknown.count(callee) && reentered.insert(callee).second)
+					work.push_back(callee);
 		}
+	}
 
-		for (auto *obj : memObj)
-			pointsTo[obj];
+	// Nothing when not asked for or when F has no body.
+	std::unique_ptr<FlowSensitiveAnalysis> refine(PointerAnalysis &andersen, Function &F)
+	{
+		if (!FAM || F.isDeclaration())
+			return nullptr;
+		MemorySSA &MSSA = FAM->getResult<MemorySSAAnalysis>(F).getMSSA();
+		return std::make_unique<FlowSensitiveAnalysis>(andersen, F, MSSA, recursive.count(&F));
+	}
+};
 
-		for (auto &gVar : M->globals())
+// Andersen results as an alias analysis provider for the new pass manager.
+// Each function is solved in open-world mode on first use and query
+// answers are cached for the lifetime of the result.
+class AndersenAAResult : public AAResultBase
+{
+	using AliasKey = std::pair<std::pair<const Value *, uint64_t>, std::pair<const Value *, uint64_t>>;
+
+	// A deleted value's address can be reused by a new one while the
+	// result is still alive (GVN deletes as it queries), so every value the
+	// analysis knows is watched. One that goes away is forgotten by the
+	// analysis and the cached answers are dropped. Kept on the heap so the
+	// watchers' pointer survives moving the result.
+	struct AliasCache;
+	struct WatchConfig : ValueMapConfig<const Value *>
+	{
+		enum { FollowRAUW = false };
+		using ExtraData = AliasCache *;
+		static void onDelete(AliasCache *cache, const Value *val)
 		{
-			if (gVar.hasInitializer())
-			{
-				const Constant *init = gVar.getInitializer();
-				if (const Value *target = getPtrOpd(init))
-				{
-					pointsTo[&gVar].insert(target);
-				}
-			}
+			cache->PA->forget(val);
+			cache->answers.clear();
 		}
+	};
+	struct AliasCache
+	{
+		PointerAnalysis *PA;
+		llvm::DenseMap<AliasKey, AliasResult> answers;
+		ValueMap<const Value *, bool, WatchConfig> watched{this};
+	};
 
-		for (const BasicBlock &basicBlk : Fn)
-		{
-			for (const Instruction &inst : basicBlk)
-			{
-				if (auto *sInst = dyn_cast<StoreInst>(&inst))
-				{ // Looks very clumsy >>> Need refactoring
-					const Value *val = sInst->getValueOperand();
-					const Value *ptr = sInst->getPointerOperand();
-					const Value *memp, *memV;
-					memp = getPtrObj(ptr);
-					memV = getPtrObj(val);
-					if (memp && memV)
-						pointsTo[memp].insert(memV);
-					else
-						store.emplace_back(ptr, val);
-					continue;
-				}
+	std::unique_ptr<PointerAnalysis> PA;
+	std::unique_ptr<AliasCache> aliasCache;
 
-				if (auto *loadInst = dyn_cast<LoadInst>(&inst)){
-					const Value *ptr = loadInst->getPointerOperand();
-					pointsTo[&inst];
-					load.emplace_back(&inst, ptr);
-					continue;
-				}
+	static std::optional<uint64_t> accessSize(const MemoryLocation &Loc)
+	{
+		if (!Loc.Size.hasValue() || Loc.Size.isScalable())
+			return std::nullopt;
+		return Loc.Size.getValue().getFixedValue();
+	}
 
-				if (auto *bitcastInst = dyn_cast<BitCastInst>(&inst)){
-					pointsTo[bitcastInst];
-					copy.emplace_back(bitcastInst, bitcastInst->getOperand(0));
-					continue;
-				}
+	// A pointer a pass created after the solve is added to the analysis
+	// when it can be derived from pointers the analysis knows, and watched
+	// like the others. Otherwise the analysis only knows it if it is an
+	// object's address.
+	void track(const Value *ptr)
+	{
+		if (PA->numbered(ptr))
+			return;
+		size_t known = PA->values().size();
+		if (!PA->addValue(ptr))
+			return;
+		for (const Value *val : PA->values().drop_front(known))
+			if (val)
+				aliasCache->watched.insert({val, true});
+		aliasCache->answers.clear();
+	}
 
-				if (auto *gepInst = dyn_cast<GetElementPtrInst>(&inst)){
-					pointsTo[gepInst];
-					copy.emplace_back(gepInst, gepInst->getPointerOperand());
-					continue;
-				}
+public:
+	explicit AndersenAAResult(std::unique_ptr<PointerAnalysis> PA) : PA(std::move(PA)), aliasCache(std::make_unique<AliasCache>())
+	{
+		aliasCache->PA = this->PA.get();
+		for (const Value *val : this->PA->values())
+			if (val)
+				aliasCache->watched.insert({val, true});
+	}
+	AndersenAAResult(AndersenAAResult &&) = default;
 
-				if (auto *itpInst = dyn_cast<IntToPtrInst>(&inst))
-				{
-					pointsTo[itpInst];
-					for (const Value *mem : memObj)
-						copy.emplace_back(itpInst, mem);
+	using AAResultBase::getModRefInfo;
 
-					continue;
-				}
+	AliasResult alias(const MemoryLocation &LocA, const MemoryLocation &LocB, AAQueryInfo &AAQI, const Instruction *CtxI)
+	{
+		track(LocA.Ptr);
+		track(LocB.Ptr);
+		std::pair<const Value *, uint64_t> keyA(LocA.Ptr, LocA.Size.toRaw()), keyB(LocB.Ptr, LocB.Size.toRaw());
+		const MemoryLocation *locA = &LocA, *locB = &LocB;
+		if (keyA > keyB)
+		{
+			std::swap(keyA, keyB);
+			std::swap(locA, locB);
+		}
+		auto it = aliasCache->answers.find({keyA, keyB});
+		if (it != aliasCache->answers.end())
+			return it->second;
+		bool may = PA->mayAlias(locA->Ptr, accessSize(*locA), locB->Ptr, accessSize(*locB));
+		AliasResult result = may ? AliasResult::MayAlias : AliasResult::NoAlias;
+		// Values created after the solve are not known to the analysis but
+		// can end up in the cache.
+		aliasCache->watched.insert({locA->Ptr, true});
+		aliasCache->watched.insert({locB->Ptr, true});
+		aliasCache->answers.try_emplace({keyA, keyB}, result);
+		return result;
+	}
 
-				if (auto *callInst = dyn_cast<CallInst>(&inst))
-				{
-					if (callInst->getType()->isPointerTy()){
-						pointsTo[callInst];
-						for (const Value *mem : memObj){
-							copy.emplace_back(callInst, mem);
-						}
-					}
+	// A call can only touch objects whose address got out of the function.
+	ModRefInfo getModRefInfo(const CallBase *Call, const MemoryLocation &Loc, AAQueryInfo &AAQI)
+	{
+		track(Loc.Ptr);
+		if (!PA->mayBeExposed(Loc.Ptr))
+			return ModRefInfo::NoModRef;
+		return ModRefInfo::ModRef;
+	}
+};
 
-					SmallVector<const Value *, 8> ptrargs;
-					for (const auto &arg : callInst->args())
-					{
-						if (arg->getType()->isPointerTy())
-							ptrargs.push_back(arg.get());
-					}
+class AndersenAA : public AnalysisInfoMixin<AndersenAA>
+{
+	friend AnalysisInfoMixin<AndersenAA>;
+	static AnalysisKey Key;
 
-					for (const Value *a1 : ptrargs){
-						for (const Value *a2 : ptrargs)
-							store.emplace_back(a1, a2);
-					}
-					continue;
-				}
+public:
+	using Result = AndersenAAResult;
 
-				if (auto *phi = dyn_cast<PHINode>(&inst))
-				{
-					if (phi->getType()->isPointerTy())
-					{
-						pointsTo[phi];
-						for (unsigned i = 0, n = phi->getNumIncomingValues(); i < n; ++i)
-						{
-							const Value *incomingVal = phi->getIncomingValue(i);
-							if (incomingVal->getType()->isPointerTy())
-								copy.emplace_back(phi, incomingVal);
-						}
-					}
-					continue;
-				}
+	Result run(Function &F, FunctionAnalysisManager &)
+	{
+		return AndersenAAResult(std::make_unique<PointerAnalysis>(F, /*openWorld=*/true));
+	}
+};
 
-				if (auto *selectInst = dyn_cast<SelectInst>(&inst))
-				{
-					if (selectInst->getType()->isPointerTy())
-					{
-						pointsTo[selectInst];
-						const Value *trueVal = selectInst->getTrueValue();
-						const Value *falseVal = selectInst->getFalseValue();
-						if (trueVal->getType()->isPointerTy())
-							copy.emplace_back(selectInst, trueVal);
-						if (falseVal->getType()->isPointerTy())
-							copy.emplace_back(selectInst, falseVal);
-					}
-					continue;
-				}
-			}
-		}
+AnalysisKey AndersenAA::Key;
 
-		bool modified = true;
-		while (modified)
-		{
-			modified = false;
+// Writes a record of every solve to -pta-stats as the pass goes.
+class StatsDump
+{
+	std::unique_ptr<raw_fd_ostream> out;
+	std::unique_ptr<json::OStream> json;
 
-			if (pCopy(pointsTo))
-				modified = true;
+public:
+	StatsDump()
+	{
+		if (StatsFile.empty())
+			return;
+		std::error_code ec;
+		out = std::make_unique<raw_fd_ostream>(StatsFile, ec, sys::fs::OF_Text);
+		if (ec)
+		{
+			errs() << "pointer-analysis: cannot write " << StatsFile << ": " << ec.message() << "\n";
+			out.reset();
+			return;
+		}
+		json = std::make_unique<json::OStream>(*out, 2);
+		json->objectBegin();
+		json->attributeBegin("solves");
+		json->arrayBegin();
+	}
 
-			if (pStore(pointsTo))
-				modified = true;
+	~StatsDump()
+	{
+		if (!json)
+			return;
+		json->arrayEnd();
+		json->attributeEnd();
+		json->objectEnd();
+		json.reset();
+		*out << "\n";
+	}
 
-			if (pLoad(pointsTo))
-				modified = true;
-		}
+	void add(PointerAnalysis &andersen, StringRef name)
+	{
+		if (json)
+			andersen.writeStats(*json, name);
+	}
+};
 
+static void writeCallGraph(PointerAnalysis &andersen)
+{
+	if (CallGraphFile.empty())
+		return;
+	std::error_code ec;
+	raw_fd_ostream out(CallGraphFile, ec, sys::fs::OF_Text);
+	if (ec)
+	{
+		errs() << "pointer-analysis: cannot write " << CallGraphFile << ": " << ec.message() << "\n";
+		return;
+	}
+	andersen.writeCallGraph(out);
+}
 
-		std::map<StringRef, Value *> programVariables;
-		const Module *m = Fn.getParent();
+// Answers every query in -pta-queries against one solve per function (or
+// one for the module), in file order. Lines are `function var1 var2`, with
+// the variables named as in NameIndex or else by their IR names, and each
+// answer is the query followed by the objects both variables may point to.
+// Lines `function +kind dst src [offset]` and `function -kind ...` add or
+// remove a constraint through PointerAnalysis::update() between queries;
+// their answer says whether it was applied.
+static void answerQueries(Module &M, const NameIndex &names, StatsDump &stats, FlowRefiner &flow)
+{
+	auto buffer = MemoryBuffer::getFile(QueryFile);
+	if (!buffer)
+	{
+		errs() << "pointer-analysis: cannot read " << QueryFile << ": " << buffer.getError().message() << "\n";
+		return;
+	}
+	std::error_code ec;
+	raw_fd_ostream out(QueryOutput, ec, sys::fs::OF_Text);
+	if (ec)
+	{
+		errs() << "pointer-analysis: cannot write " << QueryOutput << ": " << ec.message() << "\n";
+		return;
+	}
 
-		for (const GlobalVariable &gv : m->globals())
+	struct Query
+	{
+		StringRef line;
+		const Function *F;
+		StringRef varA, varB;
+		// Edits only: what to add or remove, with varA and varB as its
+		// destination and source.
+		std::optional<bool> add;
+		ConstraintKind kind;
+		int64_t offset;
+	};
+	std::vector<Query> queries;
+	SmallVector<StringRef, 0> lines;
+	(*buffer)->getBuffer().split(lines, '\n');
+	for (unsigned lineNo = 0; lineNo < lines.size(); ++lineNo)
+	{
+		StringRef line = lines[lineNo].split('#').first.trim();
+		if (line.empty())
+			continue;
+		SmallVector<StringRef, 5> fields;
+		SplitString(line, fields);
+		if (fields.size() >= 2 && (fields[1].startswith("+") || fields[1].startswith("-")))
 		{
-			if (gv.hasName())
+			static const char *const KindNames[] = {"addr", "copy", "load", "store", "gep"};
+			StringRef kind = fields[1].drop_front();
+			auto named = llvm::find(KindNames, kind);
+			int64_t offset = 0;
+			if (named == std::end(KindNames) || fields.size() != (kind == "gep" ? 5u : 4u) || (kind == "gep" && fields[4].getAsInteger(10, offset)))
 			{
-				programVariables[gv.getName()] = const_cast<llvm::GlobalVariable *>(&gv);
+				errs() << QueryFile << ":" << lineNo + 1 << ": expected `function +kind dst src` or `function -kind dst src`, with an offset after a gep, edit ignored\n";
+				continue;
 			}
+			queries.push_back({line, M.getFunction(fields[0]), fields[2], fields[3], fields[1][0] == '+', ConstraintKind(named - std::begin(KindNames)), offset});
+			continue;
 		}
-
-		for (auto &BB : Fn)
+		if (fields.size() != 3)
 		{
-			for (auto &I : BB)
-			{
-				// Get all the memory obejects.
-				for (DbgVariableRecord &DVR : filterDbgVars(I.getDbgRecordRange()))
-					programVariables[DVR.getVariable()->getName()] = DVR.getAddress();
-			}
+			errs() << QueryFile << ":" << lineNo + 1 << ": expected `function var1 var2`, query ignored\n";
+			continue;
 		}
+		queries.push_back({line, M.getFunction(fields[0]), fields[1], fields[2]});
+	}
+	auto lookup = [&](const Function &F, StringRef name) -> const Value *
+	{
+		if (const Value *val = names.lookup(F, name))
+			return val;
+		return F.getValueSymbolTable()->lookup(name);
+	};
 
-		StringRef varA = "a";
-		StringRef varB = "b";
-
-		const Value *valA = programVariables[varA];
-		const Value *valB = programVariables[varB];
-
-		auto itA = pointsTo.find(valA);
-		auto itB = pointsTo.find(valB);
+	// Solve each function once however its queries are spread over the file,
+	// visiting functions in module order so the -pta-stats records come out
+	// the same on every run.
+	DenseMap<const Function *, unsigned> position;
+	for (const Function &F : M)
+		position.try_emplace(&F, position.size());
+	std::vector<unsigned> order(queries.size());
+	for (unsigned i = 0; i < order.size(); ++i)
+		order[i] = i;
+	std::stable_sort(order.begin(), order.end(), [&](unsigned a, unsigned b) { return position.lookup(queries[a].F) < position.lookup(queries[b].F); });
 
-		if (itA != pointsTo.end() && itB != pointsTo.end())
+	std::vector<std::string> answers(queries.size());
+	std::unique_ptr<PointerAnalysis> andersen;
+	if (WholeModule)
+		andersen = std::make_unique<PointerAnalysis>(M);
+	std::optional<uint64_t> moduleKey;
+	if (!CacheDir.empty() && !WholeModule)
+		moduleKey = PointerAnalysis::hashModule(M);
+	const Function *solved = nullptr, *refined = nullptr;
+	std::unique_ptr<FlowSensitiveAnalysis> fs;
+	for (unsigned i : order)
+	{
+		const Query &query = queries[i];
+		raw_string_ostream answer(answers[i]);
+		answer << query.line << ": ";
+		if (!query.F)
 		{
-			const ValueSet &setA = itA->second;
-			const ValueSet &setB = itB->second;
-
-			// Collect intersection
-			std::vector<std::string> names;
-			for (const Value *v : setA)
-			{
-				if (setB.count(v))
-				{
-					if (v->hasName())
-					{
-						names.push_back(v->getName().str());
-					}
-					else
-					{
-						for (const auto &entry : programVariables)
-						{
-							if (entry.second == v)
-							{
-								names.push_back(entry.first.str());
-								break;
-							}
-						}
-					}
-				}
-			}
-
-			std::sort(names.begin(), names.end());
-
-			// Print
-			llvm::errs() << "{ ";
-			if (names.empty())
-			{
-				llvm::errs() << "}";
-			}
+			answer << "no such function";
+			continue;
+		}
+		if (!WholeModule && solved != query.F)
+		{
+			if (andersen)
+				stats.add(*andersen, solved->getName());
+			andersen = std::make_unique<PointerAnalysis>(*query.F, /*openWorld=*/false, moduleKey);
+			solved = query.F;
+		}
+		const Value *valA = lookup(*query.F, query.varA), *valB = lookup(*query.F, query.varB);
+		if (query.add)
+		{
+			PointerAnalysis::ConstraintEdit edit = {query.kind, valA, valB, query.offset};
+			if (!valA || !valB)
+				answer << "no such variable";
+			else if (*query.add ? andersen->update(edit) : andersen->update({}, edit))
+				answer << "applied";
 			else
-			{
-				for (size_t i = 0; i < names.size(); i++)
-				{
-					llvm::errs() << names[i];
-					if (i + 1 < names.size())
-						llvm::errs() << " ";
-				}
-				llvm::errs() << " }";
-			}
-			llvm::errs() << "\n";
+				answer << "refused";
+			// Refinements start from the edited solution.
+			refined = nullptr;
+			continue;
 		}
-		else
+		if (refined != query.F)
 		{
-			llvm::errs() << "Not sure what's happening here\n";
+			fs = flow.refine(*andersen, const_cast<Function &>(*query.F));
+			refined = query.F;
 		}
+		if (auto common = fs ? fs->commonObjects(valA, valB, names) : andersen->commonObjects(valA, valB, names))
+			printObjects(answer, *common);
+		else
+			answer << "no such variable";
 	}
-};
+	for (const std::string &answer : answers)
+		out << answer << "\n";
+	if (andersen && WholeModule)
+		writeCallGraph(*andersen);
+	if (andersen)
+		stats.add(*andersen, WholeModule ? StringRef(M.getModuleIdentifier()) : solved->getName());
+}
 
 // Pointer Analysis
-void analyseFunction(Module &M)
+void analyseFunction(Module &M, ModuleAnalysisManager &AM)
 {
+	NameIndex names(M);
+	StatsDump stats;
+	FlowRefiner flow(M, AM);
+	auto report = [&](PointerAnalysis &andersen, Function &F)
+	{
+		if (auto fs = flow.refine(andersen, F))
+			fs->report(names);
+		else
+			andersen.report(F, names);
+	};
 
-	std::map<StringRef, Value *> programVariables;
-	for (Function &F : M)
+	if (!CallGraphFile.empty() && !WholeModule)
+		errs() << "pointer-analysis: -pta-callgraph needs -pta-whole-module, ignored\n";
+	if (!QueryFile.empty())
+		answerQueries(M, names, stats, flow);
+	else if (WholeModule)
 	{
-		PointerAnalysis andersen(F);
+		PointerAnalysis andersen(M);
+		for (Function &F : M)
+			report(andersen, F);
+		writeCallGraph(andersen);
+		stats.add(andersen, M.getModuleIdentifier());
+	}
+	else
+	{
+		std::optional<uint64_t> moduleKey;
+		if (!CacheDir.empty())
+			moduleKey = PointerAnalysis::hashModule(M);
+		for (Function &F : M)
+		{
+			PointerAnalysis andersen(F, /*openWorld=*/false, moduleKey);
+			report(andersen, F);
+			stats.add(andersen, F.getName());
+		}
 	}
 }
 
@@ -402,7 +4624,7 @@ public:
 
 	PreservedAnalyses run(Module &M, ModuleAnalysisManager &AM)
 	{
-		analyseFunction(M);
+		analyseFunction(M, AM);
 		return PreservedAnalyses::all();
 	};
 };
@@ -416,6 +4638,21 @@ llvmGetPassPluginInfo()
 		.PluginVersion = "v0.1",
 		.RegisterPassBuilderCallbacks = [](PassBuilder &PB)
 		{
+			PB.registerAnalysisRegistrationCallback(
+				[](FunctionAnalysisManager &FAM)
+				{
+					FAM.registerPass([] { return AndersenAA(); });
+				});
+			PB.registerParseAACallback(
+				[](StringRef Name, AAManager &AAM)
+				{
+					if (Name == "andersen-aa")
+					{
+						AAM.registerFunctionAnalysis<AndersenAA>();
+						return true;
+					}
+					return false;
+				});
 			PB.registerPipelineParsingCallback(
 				[](StringRef Name, ModulePassManager &MPM, ArrayRef<PassBuilder::PipelineElement>)
 				{
@@ -0,0 +1,70 @@
+#ifndef POINTER_ANALYSIS_UNION_WORDS_H
+#define POINTER_ANALYSIS_UNION_WORDS_H
+
+// Union-and-detect-change over dense bitsets: dst |= src for `words` 64-bit
+// words, returning whether any bit of dst was new. The vector versions
+// accumulate the bits src adds (src & ~dst) and test them once at the end,
+// so the loop has no branches. AVX2 is picked at run time, as the plugin
+// is built for the baseline target; SSE2 is part of that baseline on x86-64.
+// Shared by the plugin and bench/union_bench.cc.
+#include <cstddef>
+#include <cstdint>
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#include <immintrin.h>
+#define PTA_X86_KERNELS
+#endif
+
+static bool unionWordsScalar(uint64_t *dst, const uint64_t *src, size_t words)
+{
+	uint64_t added = 0;
+	for (size_t i = 0; i < words; ++i)
+	{
+		added |= src[i] & ~dst[i];
+		dst[i] |= src[i];
+	}
+	return added != 0;
+}
+
+#ifdef PTA_X86_KERNELS
+static bool unionWordsSSE2(uint64_t *dst, const uint64_t *src, size_t words)
+{
+	__m128i added = _mm_setzero_si128();
+	size_t i = 0;
+	for (; i + 2 <= words; i += 2)
+	{
+		__m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i *>(dst + i));
+		__m128i s = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i));
+		added = _mm_or_si128(added, _mm_andnot_si128(d, s));
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i), _mm_or_si128(d, s));
+	}
+	bool grew = _mm_movemask_epi8(_mm_cmpeq_epi8(added, _mm_setzero_si128())) != 0xFFFF;
+	return unionWordsScalar(dst + i, src + i, words - i) || grew;
+}
+
+__attribute__((target("avx2"))) static bool unionWordsAVX2(uint64_t *dst, const uint64_t *src, size_t words)
+{
+	__m256i added = _mm256_setzero_si256();
+	size_t i = 0;
+	for (; i + 4 <= words; i += 4)
+	{
+		__m256i d = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(dst + i));
+		__m256i s = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + i));
+		added = _mm256_or_si256(added, _mm256_andnot_si256(d, s));
+		_mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + i), _mm256_or_si256(d, s));
+	}
+	bool grew = !_mm256_testz_si256(added, added);
+	return unionWordsScalar(dst + i, src + i, words - i) || grew;
+}
+#endif
+
+static bool unionWords(uint64_t *dst, const uint64_t *src, size_t words)
+{
+#ifdef PTA_X86_KERNELS
+	static const auto kernel = __builtin_cpu_supports("avx2") ? unionWordsAVX2 : unionWordsSSE2;
+#else
+	static const auto kernel = unionWordsScalar;
+#endif
+	return kernel(dst, src, words);
+}
+
+#endif
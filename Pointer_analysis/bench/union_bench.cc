@@ -0,0 +1,109 @@
+// Microbenchmark for the dense union-and-detect-change kernel used by wave
+// propagation (UnionWords.h). It times one union of two random bitsets,
+// including the copy of the destination, with each kernel version, against
+// inserting src's elements one at a time and against SparseBitVector's |=.
+// Every version's result is checked against the scalar kernel's first.
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+#include "../UnionWords.h"
+#include "llvm/ADT/SparseBitVector.h"
+
+// The per-element loop the kernel replaces: insert each element of src,
+// noting whether it was absent.
+static bool insertEach(uint64_t *dst, const std::vector<unsigned> &elems)
+{
+	bool grew = false;
+	for (unsigned elem : elems)
+	{
+		uint64_t bit = uint64_t(1) << (elem % 64);
+		if (!(dst[elem / 64] & bit))
+		{
+			dst[elem / 64] |= bit;
+			grew = true;
+		}
+	}
+	return grew;
+}
+
+// Average nanoseconds per call of run over reps calls, after reps / 10 + 1
+// untimed calls to warm the caches and let the clock settle.
+template <typename Fn>
+static double timeIt(Fn &&run, unsigned reps)
+{
+	for (unsigned rep = 0; rep < reps / 10 + 1; ++rep)
+		run();
+	auto start = std::chrono::steady_clock::now();
+	for (unsigned rep = 0; rep < reps; ++rep)
+		run();
+	return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / reps;
+}
+
+int main()
+{
+	std::mt19937 rng(1);
+	std::uniform_real_distribution<> coin(0, 1);
+	volatile bool sink;
+	std::printf("%8s %8s %8s %8s %8s %12s %12s\n", "objects", "density", "avx2", "sse2", "scalar", "per-element", "sparse |=");
+	for (unsigned numObjects : {1024u, 16384u, 262144u})
+		for (double density : {0.01, 0.1, 0.5})
+		{
+			size_t words = numObjects / 64;
+			std::vector<uint64_t> a(words), b(words), dst(words);
+			std::vector<unsigned> elems;
+			llvm::SparseBitVector<> sparseA, sparseB;
+			for (unsigned obj = 0; obj < numObjects; ++obj)
+			{
+				if (coin(rng) < density)
+				{
+					a[obj / 64] |= uint64_t(1) << (obj % 64);
+					sparseA.set(obj);
+				}
+				if (coin(rng) < density)
+				{
+					b[obj / 64] |= uint64_t(1) << (obj % 64);
+					elems.push_back(obj);
+					sparseB.set(obj);
+				}
+			}
+
+			// Each version must give the scalar kernel's bits and its answer
+			// to whether dst grew, both here and when nothing is new.
+			std::vector<uint64_t> expected = a;
+			bool expectedGrew = unionWordsScalar(expected.data(), b.data(), words);
+			auto check = [&](const char *name, auto &&run)
+			{
+				dst = a;
+				bool grew = run();
+				bool again = run();
+				if (dst != expected || grew != expectedGrew || again)
+				{
+					std::fprintf(stderr, "union_bench: %s disagrees with the scalar kernel (%u objects, density %.2f)\n", name, numObjects, density);
+					std::exit(1);
+				}
+			};
+
+			unsigned reps = 20000000 / numObjects + 10;
+			auto kernel = [&](const char *name, bool (*unionWords)(uint64_t *, const uint64_t *, size_t))
+			{
+				check(name, [&] { return unionWords(dst.data(), b.data(), words); });
+				return timeIt([&] { dst = a; sink = unionWords(dst.data(), b.data(), words); }, reps);
+			};
+#ifdef PTA_X86_KERNELS
+			double avx2 = __builtin_cpu_supports("avx2") ? kernel("avx2", unionWordsAVX2) : 0, sse2 = kernel("sse2", unionWordsSSE2);
+#else
+			double avx2 = 0, sse2 = 0;
+#endif
+			double scalar = kernel("scalar", unionWordsScalar);
+			check("dispatch", [&] { return unionWords(dst.data(), b.data(), words); });
+			check("per-element", [&] { return insertEach(dst.data(), elems); });
+			double perElement = timeIt([&] { dst = a; sink = insertEach(dst.data(), elems); }, reps);
+			double sparse = timeIt([&] { llvm::SparseBitVector<> result = sparseA; sink = result |= sparseB; }, reps / 10 + 1);
+			std::printf("%8u %8.2f %6.0fns %6.0fns %6.0fns %10.0fns %10.0fns\n", numObjects, density, avx2, sse2, scalar, perElement, sparse);
+		}
+	(void)sink;
+	return 0;
+}
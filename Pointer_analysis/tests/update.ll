@@ -0,0 +1,30 @@
+; Incremental updates: update.queries adds and removes constraints between
+; queries, and update.expected holds the answers (see README.md).
+@x = global i32 0
+@y = global i32 0
+@z = global i32 0
+
+define void @f(i1 %c) {
+entry:
+  %p = alloca ptr
+  %q = alloca ptr
+  store ptr @x, ptr %p
+  %a = load ptr, ptr %p
+  %b = select i1 %c, ptr %a, ptr @y
+  store ptr %b, ptr %q
+  %d = load ptr, ptr %q
+  br i1 %c, label %left, label %other
+
+other:
+  br i1 %c, label %right, label %join
+
+left:
+  br label %join
+
+right:
+  br label %join
+
+join:
+  %m = phi ptr [ %a, %left ], [ %a, %right ], [ @z, %other ]
+  ret void
+}